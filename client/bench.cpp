@@ -0,0 +1,349 @@
+#include "ocr_client.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string_view>
+
+// Headless load generator for OCRService.
+//
+// closed: each of --concurrency threads sends its next request as soon as
+//         the previous one returns.
+// open:   requests are scheduled at a fixed --rate regardless of how fast
+//         the server answers; --concurrency caps the requests in flight.
+//
+// Whenever requests follow a schedule (open loop, or closed loop with
+// --rate) latency is measured from the scheduled send time rather than the
+// actual one, so a stalled server cannot hide its queueing delay from the
+// results (coordinated omission).
+//
+// --stream-partial asks for line-by-line partial results and additionally
+// reports time to first text: until the first response of any kind.
+
+struct BenchConfig {
+    std::string server = "localhost:50051";
+    std::string image_dir;
+    std::string mode = "closed";
+    int concurrency = 4;
+    double rate = 0;          // Requests per second, 0 = unthrottled (closed only)
+    double duration_s = 30;
+    double warmup_s = 5;
+    int64_t max_requests = 0; // 0 = run for the whole duration
+    int timeout_ms = 0;
+    std::string json_path;    // "-" writes JSON to stdout
+    bool stream_partial = false;
+    int batch_id = 0;         // Fair-queuing flow on a server run with --fair-by=batch
+    ocr::Priority priority = ocr::NORMAL;
+};
+
+struct Sample {
+    double latency_ms;
+    double first_text_ms;
+    double server_ms;
+    bool ok;
+    bool rejected;
+    bool cache_hit;
+};
+
+struct Summary {
+    size_t ok;
+    size_t errors;
+    size_t rejected;
+    size_t cache_hits;
+    double elapsed_s;
+    double throughput;
+    double mean_ms;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double p999_ms;
+    double max_ms;
+    double server_mean_ms;
+    double first_text_p50_ms;
+    double first_text_p99_ms;
+};
+
+std::vector<std::pair<std::string, std::string>> load_images(const std::string& dir) {
+    static const std::vector<std::string> extensions = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff"};
+    
+    std::vector<std::pair<std::string, std::string>> images;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (!entry.is_regular_file()) continue;
+        
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (std::find(extensions.begin(), extensions.end(), ext) == extensions.end()) continue;
+        
+        std::ifstream file(entry.path(), std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        images.emplace_back(entry.path().filename().string(), std::move(data));
+    }
+    std::sort(images.begin(), images.end());
+    return images;
+}
+
+double percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t rank = static_cast<size_t>(std::ceil(q * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+Summary summarize(const std::vector<Sample>& samples, double elapsed_s) {
+    Summary s{};
+    std::vector<double> latencies;
+    std::vector<double> first_text;
+    double server_total = 0;
+    
+    for (const Sample& sample : samples) {
+        if (sample.rejected) s.rejected++;
+        if (!sample.ok) {
+            s.errors++;
+            continue;
+        }
+        s.ok++;
+        if (sample.cache_hit) s.cache_hits++;
+        latencies.push_back(sample.latency_ms);
+        first_text.push_back(sample.first_text_ms);
+        server_total += sample.server_ms;
+    }
+    
+    std::sort(latencies.begin(), latencies.end());
+    s.elapsed_s = elapsed_s;
+    s.throughput = elapsed_s > 0 ? s.ok / elapsed_s : 0;
+    if (!latencies.empty()) {
+        double sum = 0;
+        for (double l : latencies) sum += l;
+        s.mean_ms = sum / latencies.size();
+        s.p50_ms = percentile(latencies, 0.50);
+        s.p90_ms = percentile(latencies, 0.90);
+        s.p99_ms = percentile(latencies, 0.99);
+        s.p999_ms = percentile(latencies, 0.999);
+        s.max_ms = latencies.back();
+        s.server_mean_ms = server_total / latencies.size();
+        std::sort(first_text.begin(), first_text.end());
+        s.first_text_p50_ms = percentile(first_text, 0.50);
+        s.first_text_p99_ms = percentile(first_text, 0.99);
+    }
+    return s;
+}
+
+void print_table(const BenchConfig& config, const Summary& s) {
+    std::printf("\n=== OCR Benchmark (%s loop) ===\n", config.mode.c_str());
+    std::printf("Server:       %s\n", config.server.c_str());
+    std::printf("Concurrency:  %d\n", config.concurrency);
+    if (config.rate > 0) std::printf("Target rate:  %.1f req/s\n", config.rate);
+    std::printf("Measured:     %.2f s\n\n", s.elapsed_s);
+    std::printf("%-14s %12s\n", "metric", "value");
+    std::printf("%-14s %12zu\n", "ok", s.ok);
+    std::printf("%-14s %12zu\n", "errors", s.errors);
+    std::printf("%-14s %12zu\n", "rejected", s.rejected);
+    std::printf("%-14s %12zu\n", "cache_hits", s.cache_hits);
+    std::printf("%-14s %12.2f\n", "throughput/s", s.throughput);
+    std::printf("%-14s %12.2f\n", "mean_ms", s.mean_ms);
+    std::printf("%-14s %12.2f\n", "p50_ms", s.p50_ms);
+    std::printf("%-14s %12.2f\n", "p90_ms", s.p90_ms);
+    std::printf("%-14s %12.2f\n", "p99_ms", s.p99_ms);
+    std::printf("%-14s %12.2f\n", "p999_ms", s.p999_ms);
+    std::printf("%-14s %12.2f\n", "max_ms", s.max_ms);
+    std::printf("%-14s %12.2f\n", "server_ms", s.server_mean_ms);
+    if (config.stream_partial) {
+        std::printf("%-14s %12.2f\n", "first_p50_ms", s.first_text_p50_ms);
+        std::printf("%-14s %12.2f\n", "first_p99_ms", s.first_text_p99_ms);
+    }
+}
+
+std::string to_json(const BenchConfig& config, const Summary& s) {
+    char buf[1024];
+    std::snprintf(buf, sizeof(buf),
+        "{\"mode\":\"%s\",\"server\":\"%s\",\"concurrency\":%d,\"target_rate\":%.3f,"
+        "\"elapsed_s\":%.3f,\"ok\":%zu,\"errors\":%zu,\"rejected\":%zu,\"cache_hits\":%zu,"
+        "\"throughput\":%.3f,\"latency_ms\":{\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+        "\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},\"server_mean_ms\":%.3f,"
+        "\"first_text_ms\":{\"p50\":%.3f,\"p99\":%.3f}}",
+        config.mode.c_str(), config.server.c_str(), config.concurrency, config.rate,
+        s.elapsed_s, s.ok, s.errors, s.rejected, s.cache_hits, s.throughput,
+        s.mean_ms, s.p50_ms, s.p90_ms, s.p99_ms, s.p999_ms, s.max_ms, s.server_mean_ms,
+        s.first_text_p50_ms, s.first_text_p99_ms);
+    return buf;
+}
+
+void usage() {
+    std::cerr << "Usage: ocr_bench <image_dir> [server] [--mode=closed|open] [--concurrency=N]\n"
+              << "                 [--rate=REQ_PER_S] [--duration=S] [--warmup=S] [--requests=N]\n"
+              << "                 [--timeout-ms=MS] [--json=PATH|-] [--stream-partial]\n"
+              << "                 [--batch-id=N] [--priority=interactive|normal|bulk]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    std::vector<std::string> positional;
+    
+    // Set while parsing, so a malformed number names its argument
+    std::string_view current;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            current = arg;
+            if (!arg.starts_with("--")) {
+                positional.emplace_back(arg);
+                continue;
+            }
+            
+            size_t eq = arg.find('=');
+            std::string key(arg.substr(2, eq == std::string_view::npos ? std::string_view::npos : eq - 2));
+            std::string value(eq == std::string_view::npos ? "" : arg.substr(eq + 1));
+            
+            if (key == "mode") config.mode = value;
+            else if (key == "concurrency") config.concurrency = std::stoi(value);
+            else if (key == "rate") config.rate = std::stod(value);
+            else if (key == "duration") config.duration_s = std::stod(value);
+            else if (key == "warmup") config.warmup_s = std::stod(value);
+            else if (key == "requests") config.max_requests = std::stoll(value);
+            else if (key == "timeout-ms") config.timeout_ms = std::stoi(value);
+            else if (key == "json") config.json_path = value;
+            else if (key == "stream-partial") config.stream_partial = true;
+            else if (key == "batch-id") config.batch_id = std::stoi(value);
+            else if (key == "priority" && value == "interactive") config.priority = ocr::INTERACTIVE;
+            else if (key == "priority" && value == "normal") config.priority = ocr::NORMAL;
+            else if (key == "priority" && value == "bulk") config.priority = ocr::BULK;
+            else {
+                usage();
+                return 1;
+            }
+        }
+    } catch (const std::logic_error&) {
+        // std::stoi and friends on a malformed or out-of-range number
+        std::cerr << "Bad number in " << current << std::endl;
+        usage();
+        return 1;
+    }
+    
+    if (positional.empty() || (config.mode != "closed" && config.mode != "open") ||
+        (config.mode == "open" && config.rate <= 0) || config.concurrency < 1) {
+        usage();
+        return 1;
+    }
+    config.image_dir = positional[0];
+    if (positional.size() > 1) {
+        config.server = positional[1];
+    }
+    
+    auto images = load_images(config.image_dir);
+    if (images.empty()) {
+        std::cerr << "No images found in " << config.image_dir << std::endl;
+        return 1;
+    }
+    
+    // Pre-build requests so serialization setup is not part of the latency
+    std::vector<ImageRequest> requests(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        requests[i].set_filename(images[i].first);
+        requests[i].set_image_data(images[i].second);
+        requests[i].set_batch_id(config.batch_id);
+        requests[i].set_priority(config.priority);
+        requests[i].set_image_id(static_cast<int>(i));
+        requests[i].set_stream_partial(config.stream_partial);
+    }
+    
+    auto channel = grpc::CreateChannel(config.server, grpc::InsecureChannelCredentials());
+    OCRClient client(channel);
+    
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    const auto measure_from = start + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(config.warmup_s));
+    const auto stop_at = measure_from + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(config.duration_s));
+    
+    // Open loop uses one global schedule; a throttled closed loop gives each
+    // thread its own share of the rate
+    const bool scheduled = config.rate > 0;
+    const double interval_s = config.mode == "open" ? 1.0 / config.rate
+                            : scheduled ? config.concurrency / config.rate : 0;
+    
+    std::atomic<int64_t> next_request{0};
+    std::mutex samples_mutex;
+    std::vector<Sample> samples;
+    
+    auto run = [&](int thread_index) {
+        std::vector<Sample> local;
+        int64_t local_seq = 0;
+        
+        while (true) {
+            int64_t seq = next_request.fetch_add(1);
+            if (config.max_requests > 0 && seq >= config.max_requests) break;
+            
+            // Intended send time for this request
+            clock::time_point intended = clock::now();
+            if (scheduled) {
+                double offset = config.mode == "open" ? seq * interval_s
+                                                      : (local_seq * config.concurrency + thread_index) * interval_s / config.concurrency;
+                intended = start + std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(offset));
+                std::this_thread::sleep_until(intended);
+            }
+            local_seq++;
+            if (intended >= stop_at) break;
+            
+            // Keep the first page's final response, note when anything first arrived
+            OCRResponse response;
+            bool answered = false;
+            std::optional<clock::time_point> first_text;
+            Status status = client.ProcessImage(requests[seq % requests.size()],
+                [&](const OCRResponse& page) {
+                    if (!first_text) first_text = clock::now();
+                    if (page.partial() || answered) return;
+                    response = page;
+                    answered = true;
+                }, std::chrono::milliseconds(config.timeout_ms));
+            auto done = clock::now();
+            
+            if (intended < measure_from) continue;
+            
+            local.push_back({
+                std::chrono::duration<double, std::milli>(done - intended).count(),
+                std::chrono::duration<double, std::milli>(first_text.value_or(done) - intended).count(),
+                response.processing_time_ms(),
+                status.ok() && response.success(),
+                status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED,
+                response.cache_hit()});
+        }
+        
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        samples.insert(samples.end(), local.begin(), local.end());
+    };
+    
+    std::cerr << "Loaded " << images.size() << " images, warming up for "
+              << config.warmup_s << " s..." << std::endl;
+    
+    std::vector<std::thread> threads;
+    for (int i = 0; i < config.concurrency; ++i) {
+        threads.emplace_back(run, i);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    
+    auto end = std::min(clock::now(), stop_at);
+    double elapsed_s = std::max(0.0, std::chrono::duration<double>(end - measure_from).count());
+    Summary summary = summarize(samples, elapsed_s);
+    
+    print_table(config, summary);
+    
+    if (!config.json_path.empty()) {
+        std::string json = to_json(config, summary);
+        if (config.json_path == "-") {
+            std::cout << json << std::endl;
+        } else {
+            std::ofstream(config.json_path) << json << std::endl;
+        }
+    }
+    
+    return summary.ok > 0 ? 0 : 1;
+}
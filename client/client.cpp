@@ -12,70 +12,40 @@
 #include <QScrollArea>
 #include <QScrollBar>
 #include <QMap>
-#include <grpcpp/grpcpp.h>
-#include "ocr_service.grpc.pb.h"
+#include "ocr_client.h"
+#include <algorithm>
 #include <fstream>
+#include <map>
 #include <memory>
+#include <set>
 
-using grpc::Channel;
-using grpc::ClientContext;
-using grpc::Status;
-using ocr::OCRService;
-using ocr::ImageRequest;
-using ocr::OCRResponse;
-
-class OCRClient {
-private:
-    std::unique_ptr<OCRService::Stub> stub_;
+class BatchThread : public QThread {
+    Q_OBJECT
     
 public:
-    OCRClient(std::shared_ptr<Channel> channel)
-        : stub_(OCRService::NewStub(channel)) {}
-    
-    bool ProcessImage(const std::string& filename, const std::vector<uint8_t>& image_data,
-                     int batch_id, int image_id, std::string& result, double& time_ms,
-                     std::vector<uint8_t>& processed_image) {
-        ImageRequest request;
-        request.set_filename(filename);
-        request.set_image_data(image_data.data(), image_data.size());
-        request.set_batch_id(batch_id);
-        request.set_image_id(image_id);
-        
-        ClientContext context;
-        std::unique_ptr<grpc::ClientReader<OCRResponse>> reader(
-            stub_->ProcessImage(&context, request));
-        
-        OCRResponse response;
-        if (reader->Read(&response)) {
-            result = response.extracted_text();
-            time_ms = response.processing_time_ms();
-            
-            const std::string& img_data = response.processed_image();
-            processed_image.assign(img_data.begin(), img_data.end());
-            
-            Status status = reader->Finish();
-            return status.ok();
-        }
-        
-        return false;
-    }
-};
-
-class ProcessThread : public QThread {
-    Q_OBJECT
+    struct Item {
+        QString filename;
+        std::vector<uint8_t> image_data;
+        int image_id;
+    };
     
 private:
+    // Responses gathered for one uploaded image until all its pages are in
+    struct Document {
+        int received = 0;
+        double time_ms = 0;
+        std::map<int, std::string> pages;  // Text of the pages that succeeded
+        QByteArray image;                  // Processed first page, for the thumbnail
+        std::string error;
+    };
+    
     OCRClient* client;
-    QString filename;
-    std::vector<uint8_t> image_data;
+    std::vector<Item> items;
     int batch_id;
-    int image_id;
     
 public:
-    ProcessThread(OCRClient* client, const QString& filename, 
-                 const std::vector<uint8_t>& data, int batch_id, int image_id)
-        : client(client), filename(filename), image_data(data), 
-          batch_id(batch_id), image_id(image_id) {}
+    BatchThread(OCRClient* client, std::vector<Item> items, int batch_id)
+        : client(client), items(std::move(items)), batch_id(batch_id) {}
     
 signals:
     void resultReady(int id, QString filename, QString text, double time_ms, QByteArray processedImage);
@@ -83,23 +53,68 @@ signals:
     
 protected:
     void run() override {
-        std::string result;
-        double time_ms;
-        std::vector<uint8_t> processed_image;
+        std::vector<ImageRequest> requests;
+        requests.reserve(items.size());
+        for (const Item& item : items) {
+            ImageRequest request;
+            request.set_filename(item.filename.toStdString());
+            request.set_image_data(item.image_data.data(), item.image_data.size());
+            request.set_batch_id(batch_id);
+            request.set_image_id(item.image_id);
+            requests.push_back(std::move(request));
+        }
+        
+        std::set<int> answered;
+        std::map<int, Document> documents;
+        bool success = false;
         
         try {
-            bool success = client->ProcessImage(
-                filename.toStdString(), image_data, batch_id, image_id, result, time_ms, processed_image);
-            
-            if (success) {
-                QByteArray imgData(reinterpret_cast<const char*>(processed_image.data()), 
-                                  processed_image.size());
-                emit resultReady(image_id, filename, QString::fromStdString(result), time_ms, imgData);
-            } else {
-                emit processingError(image_id, filename, "gRPC call failed");
-            }
+            success = client->ProcessBatch(requests, [this, &answered, &documents](const OCRResponse& response) {
+                // Pages of a multi-page TIFF arrive separately, in any order
+                if (response.partial()) return;
+                Document& doc = documents[response.image_id()];
+                doc.received++;
+                doc.time_ms = std::max(doc.time_ms, response.processing_time_ms());
+                if (response.success()) {
+                    doc.pages[response.page()] = response.extracted_text();
+                    if (doc.image.isEmpty() || response.page() == 0) {
+                        const std::string& img = response.processed_image();
+                        doc.image = QByteArray(img.data(), img.size());
+                    }
+                } else if (doc.error.empty()) {
+                    doc.error = response.error_message();
+                }
+                if (doc.received < std::max(response.page_count(), 1)) return;
+                
+                answered.insert(response.image_id());
+                QString filename = QString::fromStdString(response.filename());
+                if (doc.pages.empty()) {
+                    emit processingError(response.image_id(), filename, QString::fromStdString(doc.error));
+                    return;
+                }
+                std::string text;
+                for (const auto& [page, page_text] : doc.pages) {
+                    if (!text.empty()) text += "\n\n";
+                    text += page_text;
+                }
+                emit resultReady(response.image_id(), filename, QString::fromStdString(text),
+                                 doc.time_ms, doc.image);
+            });
         } catch (const std::exception& e) {
-            emit processingError(image_id, filename, QString::fromStdString(e.what()));
+            for (const Item& item : items) {
+                if (!answered.count(item.image_id)) {
+                    emit processingError(item.image_id, item.filename, QString::fromStdString(e.what()));
+                }
+            }
+            return;
+        }
+        
+        // Anything the server never answered failed with the stream
+        for (const Item& item : items) {
+            if (!answered.count(item.image_id)) {
+                emit processingError(item.image_id, item.filename, 
+                                     success ? "No result returned" : "gRPC call failed");
+            }
         }
     }
 };
@@ -184,7 +199,7 @@ private:
     int current_batch_id;
     int total_images;
     int completed_images;
-    std::vector<ProcessThread*> active_threads;
+    std::vector<BatchThread*> active_threads;
     QMap<int, ResultWidget*> resultWidgets;
     
     static const int COLUMNS = 4;
@@ -297,6 +312,8 @@ private slots:
             clearResults();
         }
         
+        std::vector<BatchThread::Item> items;
+        
         for (const QString& filename : filenames) {
             std::ifstream file(filename.toStdString(), std::ios::binary);
             if (!file.is_open()) {
@@ -321,20 +338,25 @@ private slots:
             resultsLayout->addWidget(widget, row, col);
             resultWidgets[image_id] = widget;
             
-            // Create processing thread
-            ProcessThread* thread = new ProcessThread(
-                client, basename, image_data, current_batch_id, image_id);
+            items.push_back({basename, std::move(image_data), image_id});
+            total_images++;
+        }
+        
+        if (!items.empty()) {
+            // One streaming call carries the whole selection
+            BatchThread* thread = new BatchThread(client, std::move(items), current_batch_id);
             
-            connect(thread, &ProcessThread::resultReady, 
+            connect(thread, &BatchThread::resultReady, 
                     this, &OCRWindow::onResultReady);
-            connect(thread, &ProcessThread::processingError, 
+            connect(thread, &BatchThread::processingError, 
                     this, &OCRWindow::onProcessingError);
-            connect(thread, &ProcessThread::finished, 
-                    thread, &ProcessThread::deleteLater);
+            // A finished upload lets go of its image bytes at once
+            connect(thread, &BatchThread::finished, this, [this, thread] {
+                active_threads.erase(std::find(active_threads.begin(), active_threads.end(), thread));
+                thread->deleteLater();
+            });
             
             active_threads.push_back(thread);
-            total_images++;
-            
             thread->start();
         }
         
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include "ocr_service.grpc.pb.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using grpc::Channel;
+using grpc::ClientContext;
+using grpc::Status;
+using ocr::OCRService;
+using ocr::ImageRequest;
+using ocr::OCRResponse;
+
+// Thin wrapper over the OCRService stub, shared by the GUI and ocr_bench
+class OCRClient {
+private:
+    std::unique_ptr<OCRService::Stub> stub_;
+    
+public:
+    OCRClient(std::shared_ptr<Channel> channel)
+        : stub_(OCRService::NewStub(channel)) {}
+    
+    // Single-image call; on_page runs for every page's response as it
+    // arrives (one for most images, one per page for multi-page TIFFs).
+    // A non-zero timeout sets the call deadline.
+    Status ProcessImage(const ImageRequest& request, const std::function<void(const OCRResponse&)>& on_page,
+                        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        ClientContext context;
+        if (timeout.count() > 0) {
+            context.set_deadline(std::chrono::system_clock::now() + timeout);
+        }
+        
+        std::unique_ptr<grpc::ClientReader<OCRResponse>> reader(
+            stub_->ProcessImage(&context, request));
+        
+        bool got_response = false;
+        OCRResponse response;
+        while (reader->Read(&response)) {
+            got_response = true;
+            on_page(response);
+        }
+        Status status = reader->Finish();
+        if (status.ok() && !got_response) {
+            return Status(grpc::StatusCode::INTERNAL, "Server sent no response");
+        }
+        return status;
+    }
+    
+    // Single-image call returning the first page's final response and the
+    // gRPC status; partial results are skipped
+    Status ProcessImage(const ImageRequest& request, OCRResponse& response, 
+                        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        bool first = true;
+        return ProcessImage(request, [&response, &first](const OCRResponse& page) {
+            if (page.partial()) return;
+            if (first) response = page;
+            first = false;
+        }, timeout);
+    }
+    
+    bool ProcessImage(const std::string& filename, const std::vector<uint8_t>& image_data,
+                     int batch_id, int image_id, std::string& result, double& time_ms,
+                     std::vector<uint8_t>& processed_image) {
+        ImageRequest request;
+        request.set_filename(filename);
+        request.set_image_data(image_data.data(), image_data.size());
+        request.set_batch_id(batch_id);
+        request.set_image_id(image_id);
+        
+        OCRResponse response;
+        if (!ProcessImage(request, response).ok()) {
+            return false;
+        }
+        
+        result = response.extracted_text();
+        time_ms = response.processing_time_ms();
+        
+        const std::string& img_data = response.processed_image();
+        processed_image.assign(img_data.begin(), img_data.end());
+        return true;
+    }
+    
+    // Streams a whole batch over one call. on_response runs for every result
+    // in completion order, which may differ from the upload order.
+    bool ProcessBatch(const std::vector<ImageRequest>& requests,
+                      const std::function<void(const OCRResponse&)>& on_response) {
+        ClientContext context;
+        std::unique_ptr<grpc::ClientReaderWriter<ImageRequest, OCRResponse>> stream(
+            stub_->ProcessBatch(&context));
+        
+        // Upload on a separate thread so results can be read while sending
+        std::thread writer([&stream, &requests] {
+            for (const ImageRequest& request : requests) {
+                if (!stream->Write(request)) break;
+            }
+            stream->WritesDone();
+        });
+        
+        OCRResponse response;
+        while (stream->Read(&response)) {
+            on_response(response);
+        }
+        writer.join();
+        
+        Status status = stream->Finish();
+        return status.ok();
+    }
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Admission scheduling of the worker pool. Task is anything with a
+// std::string flow and a std::chrono::steady_clock::time_point enqueued_at;
+// TieredQueue also needs a tier_of(const Task&) next to it.
+
+// Client host of a gRPC peer such as "ipv4:10.0.0.5:41234", without the
+// port so every connection from one machine shares a flow
+inline std::string peer_host(const std::string& peer) {
+    size_t colon = peer.rfind(':');
+    if (colon == std::string::npos || colon + 1 == peer.size() ||
+        peer.find_first_not_of("0123456789", colon + 1) != std::string::npos) {
+        return peer;
+    }
+    return peer.substr(0, colon);
+}
+
+// Fair-queuing flow of a request under --fair-by: its batch, the client
+// host it came from, or one shared FIFO for "none". Clients number their
+// own batches, so a batch is only told apart together with its host.
+inline std::string flow_key(std::string_view fair_by, int32_t batch_id, const std::string& peer) {
+    if (fair_by == "batch") return peer_host(peer) + "/" + std::to_string(batch_id);
+    if (fair_by == "peer") return peer_host(peer);
+    return {};
+}
+
+// Scheduling tiers, in dispatch order
+enum class Tier { Interactive, Normal, Bulk, Count };
+
+constexpr const char* tier_names[] = {"interactive", "normal", "bulk"};
+constexpr size_t tier_count = static_cast<size_t>(Tier::Count);
+
+// Admitted tasks, one FIFO per flow (a batch or a client), served by
+// deficit round robin. Each turn adds the flow's weight to its deficit and
+// every page taken costs one, so a flow of weight 2 gets twice the pages
+// of a flow of weight 1 while both are backlogged. A 5,000-image upload
+// delays a small batch by a few pages instead of by the whole upload.
+template <typename Task>
+class FairQueue {
+private:
+    struct Flow {
+        std::deque<Task> tasks;
+        double weight;
+        double deficit = 0;
+        bool in_turn = false;
+    };
+    
+    std::unordered_map<std::string, Flow> flows;  // Only flows with queued tasks
+    std::deque<std::string> active;              // Round-robin order, front is served
+    std::unordered_map<std::string, double> weights;
+    size_t count = 0;
+    
+public:
+    static constexpr double min_weight = 0.01;
+    
+    explicit FairQueue(std::unordered_map<std::string, double> weights) : weights(std::move(weights)) {}
+    
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t flow_count() const { return flows.size(); }
+    
+    // Enqueue time of the longest-waiting task; must not be called when empty
+    std::chrono::steady_clock::time_point oldest() const {
+        auto oldest = std::chrono::steady_clock::time_point::max();
+        for (const auto& [name, flow] : flows) {
+            oldest = std::min(oldest, flow.tasks.front().enqueued_at);
+        }
+        return oldest;
+    }
+    
+    void push(Task task) {
+        auto [it, added] = flows.try_emplace(task.flow);
+        if (added) {
+            auto weight = weights.find(task.flow);
+            it->second.weight = weight != weights.end() ? std::max(weight->second, min_weight) : 1.0;
+            active.push_back(task.flow);
+        }
+        it->second.tasks.push_back(std::move(task));
+        count++;
+    }
+    
+    // Must not be called when empty
+    Task pop() {
+        while (true) {
+            Flow& flow = flows.at(active.front());
+            if (!flow.in_turn) {
+                flow.deficit += flow.weight;
+                flow.in_turn = true;
+            }
+            if (flow.deficit >= 1) {
+                flow.deficit -= 1;
+                Task task = std::move(flow.tasks.front());
+                flow.tasks.pop_front();
+                count--;
+                // A flow that runs dry leaves the round and keeps no credit
+                if (flow.tasks.empty()) {
+                    flows.erase(active.front());
+                    active.pop_front();
+                }
+                return task;
+            }
+            flow.in_turn = false;
+            active.push_back(std::move(active.front()));
+            active.pop_front();
+        }
+    }
+};
+
+// Multi-level queue of one FairQueue per tier. Tasks are taken from the
+// highest tier that has any, so interactive pages never queue behind bulk
+// ones. A lower tier whose oldest page has waited longer than max_wait is
+// served first instead, but at most every rescue_interval-th time so a
+// bulk backlog cannot take over from live traffic in turn.
+template <typename Task>
+class TieredQueue {
+private:
+    std::vector<FairQueue<Task>> tiers;
+    std::chrono::milliseconds max_wait;
+    size_t since_rescue = 0;
+    
+public:
+    static constexpr size_t rescue_interval = 4;
+    
+    TieredQueue(const std::unordered_map<std::string, double>& weights, std::chrono::milliseconds max_wait)
+        : max_wait(max_wait) {
+        for (size_t i = 0; i < tier_count; ++i) {
+            tiers.emplace_back(weights);
+        }
+    }
+    
+    bool empty() const { return size() == 0; }
+    
+    size_t size() const {
+        size_t total = 0;
+        for (const FairQueue<Task>& tier : tiers) total += tier.size();
+        return total;
+    }
+    
+    size_t flow_count() const {
+        size_t total = 0;
+        for (const FairQueue<Task>& tier : tiers) total += tier.flow_count();
+        return total;
+    }
+    
+    size_t depth(Tier tier) const { return tiers[size_t(tier)].size(); }
+    
+    void push(Task task) {
+        tiers[size_t(tier_of(task))].push(std::move(task));
+    }
+    
+    // Must not be called when empty
+    Task pop() {
+        since_rescue++;
+        if (max_wait.count() > 0 && since_rescue >= rescue_interval) {
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = tier_count - 1; i > 0; --i) {
+                if (!tiers[i].empty() && now - tiers[i].oldest() > max_wait) {
+                    since_rescue = 0;
+                    return tiers[i].pop();
+                }
+            }
+        }
+        size_t i = 0;
+        while (tiers[i].empty()) i++;
+        return tiers[i].pop();
+    }
+};
@@ -0,0 +1,190 @@
+#include "fair_queue.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Dispatch order of the admission queue: flows within a tier, then tiers.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Task {
+    std::string flow;
+    Clock::time_point enqueued_at = Clock::now();
+    int id = 0;
+    Tier tier = Tier::Normal;
+};
+
+Tier tier_of(const Task& task) {
+    return task.tier;
+}
+
+// Flows of the next count tasks popped
+std::vector<std::string> pop_flows(FairQueue<Task>& queue, size_t count) {
+    std::vector<std::string> flows;
+    for (size_t i = 0; i < count && !queue.empty(); ++i) {
+        flows.push_back(queue.pop().flow);
+    }
+    return flows;
+}
+
+TEST(FairQueue, KeepsOrderWithinAFlow) {
+    FairQueue<Task> queue({});
+    for (int i = 0; i < 5; ++i) queue.push({"a", Clock::now(), i});
+    for (int i = 0; i < 5; ++i) EXPECT_EQ(queue.pop().id, i);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(FairQueue, AlternatesFlowsOfEqualWeight) {
+    FairQueue<Task> queue({});
+    for (int i = 0; i < 4; ++i) queue.push({"big"});
+    queue.push({"small"});
+    EXPECT_EQ(queue.size(), 5u);
+    EXPECT_EQ(queue.flow_count(), 2u);
+    
+    EXPECT_EQ(pop_flows(queue, 5), (std::vector<std::string>{"big", "small", "big", "big", "big"}));
+    EXPECT_EQ(queue.flow_count(), 0u);
+}
+
+TEST(FairQueue, SharesPagesByWeight) {
+    FairQueue<Task> queue({{"a", 2.0}, {"b", 1.0}});
+    for (int i = 0; i < 30; ++i) {
+        queue.push({"a"});
+        queue.push({"b"});
+    }
+    
+    EXPECT_EQ(pop_flows(queue, 6), (std::vector<std::string>{"a", "a", "b", "a", "a", "b"}));
+    std::vector<std::string> flows = pop_flows(queue, 24);
+    EXPECT_EQ(std::count(flows.begin(), flows.end(), "a"), 16);
+    EXPECT_EQ(std::count(flows.begin(), flows.end(), "b"), 8);
+}
+
+TEST(FairQueue, FractionalWeightsAccumulate) {
+    FairQueue<Task> queue({{"slow", 0.5}});
+    for (int i = 0; i < 20; ++i) {
+        queue.push({"slow"});
+        queue.push({"fast"});
+    }
+    
+    std::vector<std::string> flows = pop_flows(queue, 15);
+    EXPECT_EQ(std::count(flows.begin(), flows.end(), "slow"), 5);
+    EXPECT_EQ(std::count(flows.begin(), flows.end(), "fast"), 10);
+}
+
+TEST(FairQueue, ClampsWeightsToTheMinimum) {
+    // A weight of 0 would starve the flow forever
+    FairQueue<Task> queue({{"idle", 0.0}});
+    queue.push({"idle"});
+    for (int i = 0; i < 200; ++i) queue.push({"busy"});
+    
+    std::vector<std::string> flows = pop_flows(queue, 201);
+    auto idle = std::find(flows.begin(), flows.end(), "idle");
+    ASSERT_NE(idle, flows.end());
+    EXPECT_GE(idle - flows.begin(), static_cast<long>(1 / FairQueue<Task>::min_weight) - 1);
+}
+
+TEST(FairQueue, ReportsOldestTask) {
+    FairQueue<Task> queue({});
+    Clock::time_point now = Clock::now();
+    queue.push({"a", now - std::chrono::seconds(5)});
+    queue.push({"a", now});
+    queue.push({"b", now - std::chrono::seconds(2)});
+    
+    EXPECT_EQ(queue.oldest(), now - std::chrono::seconds(5));
+    queue.pop();
+    EXPECT_EQ(queue.oldest(), now - std::chrono::seconds(2));
+}
+
+TEST(FlowKey, SeparatesPeersSendingTheSameBatch) {
+    // Every GUI client numbers its uploads from 1
+    std::string first = flow_key("batch", 1, "ipv4:10.0.0.5:41234");
+    std::string second = flow_key("batch", 1, "ipv4:10.0.0.6:41234");
+    EXPECT_NE(first, second);
+    EXPECT_EQ(first, "ipv4:10.0.0.5/1");
+    
+    // Another connection from the same machine stays in the batch
+    EXPECT_EQ(flow_key("batch", 1, "ipv4:10.0.0.5:50000"), first);
+    EXPECT_NE(flow_key("batch", 2, "ipv4:10.0.0.5:41234"), first);
+    
+    FairQueue<Task> queue({});
+    for (int i = 0; i < 3; ++i) queue.push({first});
+    queue.push({second});
+    EXPECT_EQ(queue.flow_count(), 2u);
+    EXPECT_EQ(pop_flows(queue, 2), (std::vector<std::string>{first, second}));
+}
+
+TEST(FlowKey, PeerAndNone) {
+    EXPECT_EQ(flow_key("peer", 7, "ipv6:[::1]:41234"), "ipv6:[::1]");
+    EXPECT_EQ(flow_key("peer", 7, "unix:/tmp/ocr.sock"), "unix:/tmp/ocr.sock");
+    EXPECT_EQ(flow_key("none", 7, "ipv4:10.0.0.5:41234"), "");
+}
+
+Task in_tier(Tier tier, Clock::time_point enqueued_at = Clock::now()) {
+    return {"flow", enqueued_at, 0, tier};
+}
+
+// Tiers of the next count tasks popped
+std::vector<Tier> pop_tiers(TieredQueue<Task>& queue, size_t count) {
+    std::vector<Tier> tiers;
+    for (size_t i = 0; i < count && !queue.empty(); ++i) {
+        tiers.push_back(queue.pop().tier);
+    }
+    return tiers;
+}
+
+constexpr Tier I = Tier::Interactive, N = Tier::Normal, B = Tier::Bulk;
+
+TEST(TieredQueue, ServesHigherTiersFirst) {
+    TieredQueue<Task> queue({}, std::chrono::hours(1));
+    queue.push(in_tier(B));
+    queue.push(in_tier(N));
+    queue.push(in_tier(I));
+    queue.push(in_tier(N));
+    EXPECT_EQ(queue.size(), 4u);
+    EXPECT_EQ(queue.depth(N), 2u);
+    
+    EXPECT_EQ(pop_tiers(queue, 4), (std::vector<Tier>{I, N, N, B}));
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(TieredQueue, RescuesAStarvedTierEveryFourthPop) {
+    TieredQueue<Task> queue({}, std::chrono::milliseconds(100));
+    Clock::time_point stale = Clock::now() - std::chrono::seconds(1);
+    queue.push(in_tier(B, stale));
+    queue.push(in_tier(B, stale));
+    for (int i = 0; i < 10; ++i) queue.push(in_tier(I));
+    
+    static_assert(TieredQueue<Task>::rescue_interval == 4);
+    EXPECT_EQ(pop_tiers(queue, 12), (std::vector<Tier>{I, I, I, B, I, I, I, B, I, I, I, I}));
+}
+
+TEST(TieredQueue, RescuesTheLowestTierFirst) {
+    TieredQueue<Task> queue({}, std::chrono::milliseconds(100));
+    Clock::time_point stale = Clock::now() - std::chrono::seconds(1);
+    queue.push(in_tier(N, stale));
+    queue.push(in_tier(B, stale));
+    for (int i = 0; i < 6; ++i) queue.push(in_tier(I));
+    
+    EXPECT_EQ(pop_tiers(queue, 8), (std::vector<Tier>{I, I, I, B, I, I, I, N}));
+}
+
+TEST(TieredQueue, LeavesFreshTasksWaiting) {
+    TieredQueue<Task> queue({}, std::chrono::hours(1));
+    queue.push(in_tier(B));
+    for (int i = 0; i < 6; ++i) queue.push(in_tier(I));
+    
+    EXPECT_EQ(pop_tiers(queue, 7), (std::vector<Tier>{I, I, I, I, I, I, B}));
+}
+
+TEST(TieredQueue, ZeroMaxWaitDisablesRescue) {
+    TieredQueue<Task> queue({}, std::chrono::milliseconds(0));
+    queue.push(in_tier(B, Clock::now() - std::chrono::hours(1)));
+    for (int i = 0; i < 6; ++i) queue.push(in_tier(I));
+    
+    EXPECT_EQ(pop_tiers(queue, 7), (std::vector<Tier>{I, I, I, I, I, I, B}));
+}
+
+}  // namespace
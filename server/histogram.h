@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+// Log-linear latency histogram in the spirit of HdrHistogram.
+//
+// Values are recorded in microseconds. Each power of two is split into 16
+// linear sub-buckets, so any reported percentile is within ~6% of the true
+// value, independent of magnitude. Recording is a single relaxed atomic
+// increment, so workers never contend on a lock.
+class LatencyHistogram {
+private:
+    static constexpr int sub_bits = 4;
+    static constexpr int sub_count = 1 << sub_bits;
+    static constexpr int magnitudes = 64 - sub_bits;
+    static constexpr int bucket_count = (magnitudes + 1) * sub_count;
+    
+    std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+    std::atomic<uint64_t> sum_us{0};
+    std::atomic<uint64_t> max_us{0};
+    
+    static int index_of(uint64_t us) {
+        if (us < sub_count) return static_cast<int>(us);
+        int shift = std::bit_width(us) - 1 - sub_bits;
+        return (shift + 1) * sub_count + static_cast<int>((us >> shift) & (sub_count - 1));
+    }
+    
+    // Highest value that maps to the bucket, so percentiles never under-report
+    static uint64_t upper_bound_of(int index) {
+        if (index < sub_count) return static_cast<uint64_t>(index);
+        int shift = index / sub_count - 1;
+        uint64_t sub = static_cast<uint64_t>(index % sub_count);
+        return ((sub_count + sub + 1) << shift) - 1;
+    }
+    
+public:
+    struct Snapshot {
+        uint64_t count;
+        double mean_ms;
+        double p50_ms;
+        double p90_ms;
+        double p99_ms;
+        double p999_ms;
+        double max_ms;
+    };
+    
+    void record_ms(double ms) {
+        uint64_t us = ms > 0 ? static_cast<uint64_t>(ms * 1000.0) : 0;
+        buckets[index_of(us)].fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(us, std::memory_order_relaxed);
+        
+        uint64_t prev = max_us.load(std::memory_order_relaxed);
+        while (us > prev && !max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {}
+    }
+    
+    // Reads the distribution; with reset the histogram starts a new interval.
+    // Records racing with a reset land in either interval, never both.
+    Snapshot snapshot(bool reset) {
+        std::array<uint64_t, bucket_count> counts;
+        uint64_t count = 0;
+        for (int i = 0; i < bucket_count; ++i) {
+            counts[i] = reset ? buckets[i].exchange(0, std::memory_order_relaxed)
+                              : buckets[i].load(std::memory_order_relaxed);
+            count += counts[i];
+        }
+        uint64_t sum = reset ? sum_us.exchange(0) : sum_us.load();
+        uint64_t max = reset ? max_us.exchange(0) : max_us.load();
+        
+        Snapshot snap{count, 0, 0, 0, 0, 0, max / 1000.0};
+        if (count == 0) return snap;
+        snap.mean_ms = sum / 1000.0 / count;
+        
+        const double quantiles[] = {0.50, 0.90, 0.99, 0.999};
+        double* targets[] = {&snap.p50_ms, &snap.p90_ms, &snap.p99_ms, &snap.p999_ms};
+        uint64_t seen = 0;
+        int q = 0;
+        for (int i = 0; i < bucket_count && q < 4; ++i) {
+            seen += counts[i];
+            while (q < 4 && seen >= std::max<uint64_t>(1, std::ceil(quantiles[q] * count))) {
+                *targets[q++] = std::min(upper_bound_of(i), max) / 1000.0;
+            }
+        }
+        return snap;
+    }
+};
@@ -0,0 +1,144 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef OCR_KERNELS_X86
+// Defined in kernels_sse41.cpp, kernels_avx2.cpp and kernels_avx512.cpp,
+// each compiled for its instruction set
+const KernelTable& sse41_kernels();
+const KernelTable& avx2_kernels();
+const KernelTable& avx512_kernels();
+#endif
+
+namespace {
+
+void rgb_to_gray(const uint32_t* src, uint8_t* dst, int n) {
+    for (int j = 0; j < n; ++j) {
+        uint32_t word = src[j];
+        float r = float(word >> 24);
+        float g = float((word >> 16) & 0xff);
+        float b = float((word >> 8) & 0xff);
+        dst[j] = uint8_t(int(0.3f * r + 0.5f * g + 0.2f * b + 0.5f));
+    }
+}
+
+void swap_words(const uint32_t* src, uint32_t* dst, int nwords) {
+    for (int j = 0; j < nwords; ++j) {
+        dst[j] = __builtin_bswap32(src[j]);
+    }
+}
+
+void column_update(uint16_t* colsum, const uint8_t* add, const uint8_t* sub, int n) {
+    if (add) {
+        for (int j = 0; j < n; ++j) colsum[j] = uint16_t(colsum[j] + add[j]);
+    }
+    if (sub) {
+        for (int j = 0; j < n; ++j) colsum[j] = uint16_t(colsum[j] - sub[j]);
+    }
+}
+
+void box_normalize(const uint32_t* upper, const uint32_t* lower, float norm, uint8_t* dst, int n) {
+    for (int j = 0; j < n; ++j) {
+        dst[j] = uint8_t(int(norm * float(int(upper[j] - lower[j])) + 0.5f));
+    }
+}
+
+void unsharp_combine(const uint8_t* src, const uint8_t* blur, float fract, uint8_t* dst, int n) {
+    for (int j = 0; j < n; ++j) {
+        int edge = int(float(src[j] - blur[j]) * fract);
+        dst[j] = uint8_t(std::clamp(src[j] + edge, 0, 255));
+    }
+}
+
+void linear_trc(uint8_t* row, int n, int minval, int diff, float factor) {
+    for (int j = 0; j < n; ++j) {
+        int offset = row[j] - minval;
+        if (offset <= 0) row[j] = 0;
+        else if (offset > diff) row[j] = 255;
+        else row[j] = uint8_t(int(factor * float(offset) + 0.5f));
+    }
+}
+
+void histogram(const uint8_t* row, int n, uint32_t* hist) {
+    // Four banks so runs of equal pixels do not serialize on one counter
+    uint32_t banks[4][256] = {};
+    int j = 0;
+    for (; j + 4 <= n; j += 4) {
+        banks[0][row[j]]++;
+        banks[1][row[j + 1]]++;
+        banks[2][row[j + 2]]++;
+        banks[3][row[j + 3]]++;
+    }
+    for (; j < n; ++j) banks[0][row[j]]++;
+    for (int v = 0; v < 256; ++v) {
+        hist[v] += banks[0][v] + banks[1][v] + banks[2][v] + banks[3][v];
+    }
+}
+
+void threshold_to_bits(const uint8_t* row, int n, int thresh, uint32_t* dst) {
+    std::memset(dst, 0, ((n + 31) / 32) * sizeof(uint32_t));
+    for (int j = 0; j < n; ++j) {
+        if (row[j] < thresh) dst[j >> 5] |= 0x80000000u >> (j & 31);
+    }
+}
+
+const KernelTable scalar_table = {
+    "scalar", rgb_to_gray, swap_words, column_update, box_normalize,
+    unsharp_combine, linear_trc, histogram, threshold_to_bits
+};
+
+const KernelTable* selected = &scalar_table;
+
+// Variant of the given name if it is compiled in and the CPU runs it
+const KernelTable* find_variant(const std::string& name) {
+    if (name == "scalar") return &scalar_table;
+#ifdef OCR_KERNELS_X86
+    __builtin_cpu_init();
+    if (name == "sse4" && __builtin_cpu_supports("sse4.1")) return &sse41_kernels();
+    if (name == "avx2" && __builtin_cpu_supports("avx2")) return &avx2_kernels();
+    if (name == "avx512" && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return &avx512_kernels();
+    }
+#endif
+    return nullptr;
+}
+
+constexpr const char* variants[] = {"scalar", "sse4", "avx2", "avx512"};
+
+}  // namespace
+
+namespace kernels {
+
+bool select(const std::string& variant) {
+    const KernelTable* table = nullptr;
+    if (variant == "auto") {
+        for (const char* name : variants) {
+            if (const KernelTable* candidate = find_variant(name)) table = candidate;
+        }
+    } else {
+        table = find_variant(variant);
+    }
+    if (!table) return false;
+    selected = table;
+    return true;
+}
+
+const KernelTable& active() {
+    return *selected;
+}
+
+const KernelTable& scalar() {
+    return scalar_table;
+}
+
+std::string available() {
+    std::string names;
+    for (const char* name : variants) {
+        if (!find_variant(name)) continue;
+        if (!names.empty()) names += ",";
+        names += name;
+    }
+    return names;
+}
+
+}  // namespace kernels
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Row kernels behind the accelerated preprocessing stages in ocr_core.
+//
+// Kernels work on plain buffers so they do not depend on Leptonica. 8 bpp
+// rows are in linear pixel order; Leptonica stores each 32-bit word of an
+// 8 bpp row with its bytes reversed on little-endian machines, so callers
+// convert with swap_words() first. 1 bpp output uses Leptonica's layout
+// (pixel 0 in the most significant bit of word 0).
+//
+// Every variant must produce exactly the same output as the scalar one.
+struct KernelTable {
+    const char* name;
+
+    // 0xRRGGBBAA words -> (uint8)(0.3f R + 0.5f G + 0.2f B + 0.5f), the
+    // weighting and rounding of pixConvertRGBToLuminance
+    void (*rgb_to_gray)(const uint32_t* src, uint8_t* dst, int n);
+
+    // Reverses the bytes of each 32-bit word (in place when src == dst)
+    void (*swap_words)(const uint32_t* src, uint32_t* dst, int nwords);
+
+    // colsum[j] += add[j], then colsum[j] -= sub[j]; either row may be null
+    void (*column_update)(uint16_t* colsum, const uint8_t* add, const uint8_t* sub, int n);
+
+    // dst[j] = (uint8)(norm * (upper[j] - lower[j]) + 0.5f): the normalized
+    // box sum from two entries of a running prefix sum
+    void (*box_normalize)(const uint32_t* upper, const uint32_t* lower, float norm, uint8_t* dst, int n);
+
+    // dst[j] = clamp(src[j] + (int)((src[j] - blur[j]) * fract), 0, 255)
+    void (*unsharp_combine)(const uint8_t* src, const uint8_t* blur, float fract, uint8_t* dst, int n);
+
+    // Linear stretch of [minval, minval + diff] to [0, 255] in place:
+    // 0 at or below minval, 255 above, else (int)(factor * (v - minval) + 0.5f)
+    void (*linear_trc)(uint8_t* row, int n, int minval, int diff, float factor);
+
+    // hist[v] += number of pixels with value v
+    void (*histogram)(const uint8_t* row, int n, uint32_t* hist);
+
+    // Sets bit j of the 1 bpp row where row[j] < thresh; dst is cleared first
+    void (*threshold_to_bits)(const uint8_t* row, int n, int thresh, uint32_t* dst);
+};
+
+namespace kernels {
+
+// Chooses the kernel variant: "auto" picks the widest one the CPU
+// supports, otherwise one of "scalar", "sse4", "avx2", "avx512". Returns
+// false, leaving the selection unchanged, if the variant is unavailable.
+bool select(const std::string& variant);
+
+// The selected variant; scalar until select() is called
+const KernelTable& active();
+
+const KernelTable& scalar();
+
+// Variants compiled in and supported by this CPU, widest last
+std::string available();
+
+}  // namespace kernels
@@ -0,0 +1,162 @@
+#include "kernels.h"
+#include <immintrin.h>
+
+// AVX2 kernels: 32 pixels per iteration, tails go to the scalar kernels.
+// Float math follows the scalar expressions operation by operation (the
+// library is built with -ffp-contract=off) so the results are identical.
+
+namespace {
+
+const KernelTable& tail = kernels::scalar();
+
+// Packs 4 x 8 int32 into 32 bytes in order, saturating to [0, 255]
+inline __m256i pack_bytes(__m256i a, __m256i b, __m256i c, __m256i d) {
+    __m256i ab = _mm256_packus_epi32(a, b);
+    __m256i cd = _mm256_packus_epi32(c, d);
+    __m256i bytes = _mm256_packus_epi16(ab, cd);
+    return _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+// 8 bytes widened to int32
+inline __m256i load_u8x8(const uint8_t* p) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+void rgb_to_gray(const uint32_t* src, uint8_t* dst, int n) {
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256 rw = _mm256_set1_ps(0.3f);
+    const __m256 gw = _mm256_set1_ps(0.5f);
+    const __m256 bw = _mm256_set1_ps(0.2f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    
+    auto convert = [&](const uint32_t* p) {
+        __m256i word = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_srli_epi32(word, 24));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(word, 16), mask));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(word, 8), mask));
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rw, r), _mm256_mul_ps(gw, g)), _mm256_mul_ps(bw, b));
+        return _mm256_cvttps_epi32(_mm256_add_ps(sum, half));
+    };
+    
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i out = pack_bytes(convert(src + j), convert(src + j + 8), convert(src + j + 16), convert(src + j + 24));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), out);
+    }
+    tail.rgb_to_gray(src + j, dst + j, n - j);
+}
+
+void swap_words(const uint32_t* src, uint32_t* dst, int nwords) {
+    const __m256i reverse = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                             3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    int j = 0;
+    for (; j + 8 <= nwords; j += 8) {
+        __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + j));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), _mm256_shuffle_epi8(words, reverse));
+    }
+    tail.swap_words(src + j, dst + j, nwords - j);
+}
+
+void column_update(uint16_t* colsum, const uint8_t* add, const uint8_t* sub, int n) {
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m256i sums = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colsum + j));
+        if (add) {
+            sums = _mm256_add_epi16(sums, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(add + j))));
+        }
+        if (sub) {
+            sums = _mm256_sub_epi16(sums, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + j))));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(colsum + j), sums);
+    }
+    tail.column_update(colsum + j, add ? add + j : nullptr, sub ? sub + j : nullptr, n - j);
+}
+
+void box_normalize(const uint32_t* upper, const uint32_t* lower, float norm, uint8_t* dst, int n) {
+    const __m256 scale = _mm256_set1_ps(norm);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    
+    auto average = [&](int k) {
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(upper + k));
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lower + k));
+        __m256 sum = _mm256_cvtepi32_ps(_mm256_sub_epi32(hi, lo));
+        return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(scale, sum), half));
+    };
+    
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i out = pack_bytes(average(j), average(j + 8), average(j + 16), average(j + 24));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), out);
+    }
+    tail.box_normalize(upper + j, lower + j, norm, dst + j, n - j);
+}
+
+void unsharp_combine(const uint8_t* src, const uint8_t* blur, float fract, uint8_t* dst, int n) {
+    const __m256 factor = _mm256_set1_ps(fract);
+    
+    auto sharpen = [&](int k) {
+        __m256i s = load_u8x8(src + k);
+        __m256 diff = _mm256_cvtepi32_ps(_mm256_sub_epi32(s, load_u8x8(blur + k)));
+        return _mm256_add_epi32(s, _mm256_cvttps_epi32(_mm256_mul_ps(diff, factor)));
+    };
+    
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i out = pack_bytes(sharpen(j), sharpen(j + 8), sharpen(j + 16), sharpen(j + 24));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), out);
+    }
+    tail.unsharp_combine(src + j, blur + j, fract, dst + j, n - j);
+}
+
+void linear_trc(uint8_t* row, int n, int minval, int diff, float factor) {
+    const __m256i low = _mm256_set1_epi32(minval);
+    const __m256i range = _mm256_set1_epi32(diff);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i white = _mm256_set1_epi32(255);
+    const __m256 scale = _mm256_set1_ps(factor);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    
+    auto stretch = [&](int k) {
+        __m256i offset = _mm256_sub_epi32(load_u8x8(row + k), low);
+        __m256i value = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(scale, _mm256_cvtepi32_ps(offset)), half));
+        value = _mm256_blendv_epi8(value, white, _mm256_cmpgt_epi32(offset, range));
+        return _mm256_blendv_epi8(value, zero, _mm256_cmpgt_epi32(_mm256_set1_epi32(1), offset));
+    };
+    
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i out = pack_bytes(stretch(j), stretch(j + 8), stretch(j + 16), stretch(j + 24));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + j), out);
+    }
+    tail.linear_trc(row + j, n - j, minval, diff, factor);
+}
+
+void threshold_to_bits(const uint8_t* row, int n, int thresh, uint32_t* dst) {
+    if (thresh <= 0 || thresh > 255) {
+        tail.threshold_to_bits(row, n, thresh, dst);
+        return;
+    }
+    
+    // Byte order reversed so pixel 0 lands in the top bit of the movemask
+    const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i limit = _mm256_set1_epi8(char(thresh - 1));
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j));
+        __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(v, limit), v);
+        below = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(below, reverse), 0x4e);
+        dst[j / 32] = uint32_t(_mm256_movemask_epi8(below));
+    }
+    tail.threshold_to_bits(row + j, n - j, thresh, dst + j / 32);
+}
+
+}  // namespace
+
+const KernelTable& avx2_kernels() {
+    static const KernelTable table = {
+        "avx2", rgb_to_gray, swap_words, column_update, box_normalize,
+        unsharp_combine, linear_trc, tail.histogram, threshold_to_bits
+    };
+    return table;
+}
@@ -0,0 +1,127 @@
+#include "kernels.h"
+
+// GCC 12 reports -Wmaybe-uninitialized inside _mm512_cvtepi32_ps and
+// _mm512_cvttps_epi32: a false positive on the deliberately uninitialized
+// _mm512_undefined_*() operand its own headers pass along
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+// AVX-512 (F + BW) kernels for the arithmetic-heavy rows: 16 pixels per
+// iteration, 64 when thresholding. Byte shuffles and column sums are memory
+// bound and reuse the AVX2 kernels. Float math follows the scalar
+// expressions operation by operation (the library is built with
+// -ffp-contract=off).
+
+const KernelTable& avx2_kernels();
+
+namespace {
+
+const KernelTable& tail = kernels::scalar();
+
+// 16 int32 clamped to [0, 255] and narrowed to bytes
+inline void store_bytes(uint8_t* p, __m512i v) {
+    v = _mm512_min_epi32(_mm512_max_epi32(v, _mm512_setzero_si512()), _mm512_set1_epi32(255));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm512_cvtepi32_epi8(v));
+}
+
+inline __m512i load_u8x16(const uint8_t* p) {
+    return _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+void rgb_to_gray(const uint32_t* src, uint8_t* dst, int n) {
+    const __m512i mask = _mm512_set1_epi32(0xff);
+    const __m512 rw = _mm512_set1_ps(0.3f);
+    const __m512 gw = _mm512_set1_ps(0.5f);
+    const __m512 bw = _mm512_set1_ps(0.2f);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512i word = _mm512_loadu_si512(src + j);
+        __m512 r = _mm512_cvtepi32_ps(_mm512_srli_epi32(word, 24));
+        __m512 g = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(word, 16), mask));
+        __m512 b = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(word, 8), mask));
+        __m512 sum = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(rw, r), _mm512_mul_ps(gw, g)), _mm512_mul_ps(bw, b));
+        store_bytes(dst + j, _mm512_cvttps_epi32(_mm512_add_ps(sum, half)));
+    }
+    tail.rgb_to_gray(src + j, dst + j, n - j);
+}
+
+void box_normalize(const uint32_t* upper, const uint32_t* lower, float norm, uint8_t* dst, int n) {
+    const __m512 scale = _mm512_set1_ps(norm);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512i sum = _mm512_sub_epi32(_mm512_loadu_si512(upper + j), _mm512_loadu_si512(lower + j));
+        __m512 value = _mm512_add_ps(_mm512_mul_ps(scale, _mm512_cvtepi32_ps(sum)), half);
+        store_bytes(dst + j, _mm512_cvttps_epi32(value));
+    }
+    tail.box_normalize(upper + j, lower + j, norm, dst + j, n - j);
+}
+
+void unsharp_combine(const uint8_t* src, const uint8_t* blur, float fract, uint8_t* dst, int n) {
+    const __m512 factor = _mm512_set1_ps(fract);
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512i s = load_u8x16(src + j);
+        __m512 diff = _mm512_cvtepi32_ps(_mm512_sub_epi32(s, load_u8x16(blur + j)));
+        store_bytes(dst + j, _mm512_add_epi32(s, _mm512_cvttps_epi32(_mm512_mul_ps(diff, factor))));
+    }
+    tail.unsharp_combine(src + j, blur + j, fract, dst + j, n - j);
+}
+
+void linear_trc(uint8_t* row, int n, int minval, int diff, float factor) {
+    const __m512i low = _mm512_set1_epi32(minval);
+    const __m512i range = _mm512_set1_epi32(diff);
+    const __m512 scale = _mm512_set1_ps(factor);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512i offset = _mm512_sub_epi32(load_u8x16(row + j), low);
+        __m512i value = _mm512_cvttps_epi32(_mm512_add_ps(_mm512_mul_ps(scale, _mm512_cvtepi32_ps(offset)), half));
+        value = _mm512_mask_mov_epi32(value, _mm512_cmpgt_epi32_mask(offset, range), _mm512_set1_epi32(255));
+        value = _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(offset, _mm512_setzero_si512()), value);
+        store_bytes(row + j, value);
+    }
+    tail.linear_trc(row + j, n - j, minval, diff, factor);
+}
+
+// Leptonica puts the first pixel of a word in its top bit
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    return __builtin_bswap32(x);
+}
+
+void threshold_to_bits(const uint8_t* row, int n, int thresh, uint32_t* dst) {
+    if (thresh <= 0 || thresh > 255) {
+        tail.threshold_to_bits(row, n, thresh, dst);
+        return;
+    }
+    
+    const __m512i limit = _mm512_set1_epi8(char(thresh));
+    int j = 0;
+    for (; j + 64 <= n; j += 64) {
+        uint64_t below = _mm512_cmplt_epu8_mask(_mm512_loadu_si512(row + j), limit);
+        dst[j / 32] = reverse_bits(uint32_t(below));
+        dst[j / 32 + 1] = reverse_bits(uint32_t(below >> 32));
+    }
+    tail.threshold_to_bits(row + j, n - j, thresh, dst + j / 32);
+}
+
+}  // namespace
+
+const KernelTable& avx512_kernels() {
+    const KernelTable& avx2 = avx2_kernels();
+    static const KernelTable table = {
+        "avx512", rgb_to_gray, avx2.swap_words, avx2.column_update, box_normalize,
+        unsharp_combine, linear_trc, tail.histogram, threshold_to_bits
+    };
+    return table;
+}
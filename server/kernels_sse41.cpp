@@ -0,0 +1,163 @@
+#include "kernels.h"
+#include <immintrin.h>
+
+// SSE4.1 kernels: 16 pixels per iteration, tails go to the scalar kernels.
+// Float math follows the scalar expressions operation by operation (the
+// library is built with -ffp-contract=off) so the results are identical.
+
+namespace {
+
+const KernelTable& tail = kernels::scalar();
+
+// Packs 4 x 4 int32 into 16 bytes in order, saturating to [0, 255]
+inline __m128i pack_bytes(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d));
+}
+
+// 4 bytes widened to int32
+inline __m128i load_u8x4(const uint8_t* p) {
+    int32_t bytes;
+    __builtin_memcpy(&bytes, p, sizeof(bytes));
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+}
+
+void rgb_to_gray(const uint32_t* src, uint8_t* dst, int n) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 rw = _mm_set1_ps(0.3f);
+    const __m128 gw = _mm_set1_ps(0.5f);
+    const __m128 bw = _mm_set1_ps(0.2f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    
+    auto convert = [&](const uint32_t* p) {
+        __m128i word = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128 r = _mm_cvtepi32_ps(_mm_srli_epi32(word, 24));
+        __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(word, 16), mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(word, 8), mask));
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rw, r), _mm_mul_ps(gw, g)), _mm_mul_ps(bw, b));
+        return _mm_cvttps_epi32(_mm_add_ps(sum, half));
+    };
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i out = pack_bytes(convert(src + j), convert(src + j + 4), convert(src + j + 8), convert(src + j + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), out);
+    }
+    tail.rgb_to_gray(src + j, dst + j, n - j);
+}
+
+void swap_words(const uint32_t* src, uint32_t* dst, int nwords) {
+    const __m128i reverse = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    int j = 0;
+    for (; j + 4 <= nwords; j += 4) {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), _mm_shuffle_epi8(words, reverse));
+    }
+    tail.swap_words(src + j, dst + j, nwords - j);
+}
+
+void column_update(uint16_t* colsum, const uint8_t* add, const uint8_t* sub, int n) {
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m128i sums = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colsum + j));
+        if (add) {
+            sums = _mm_add_epi16(sums, _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(add + j))));
+        }
+        if (sub) {
+            sums = _mm_sub_epi16(sums, _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(sub + j))));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(colsum + j), sums);
+    }
+    tail.column_update(colsum + j, add ? add + j : nullptr, sub ? sub + j : nullptr, n - j);
+}
+
+void box_normalize(const uint32_t* upper, const uint32_t* lower, float norm, uint8_t* dst, int n) {
+    const __m128 scale = _mm_set1_ps(norm);
+    const __m128 half = _mm_set1_ps(0.5f);
+    
+    auto average = [&](int k) {
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(upper + k));
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + k));
+        __m128 sum = _mm_cvtepi32_ps(_mm_sub_epi32(hi, lo));
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(scale, sum), half));
+    };
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i out = pack_bytes(average(j), average(j + 4), average(j + 8), average(j + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), out);
+    }
+    tail.box_normalize(upper + j, lower + j, norm, dst + j, n - j);
+}
+
+void unsharp_combine(const uint8_t* src, const uint8_t* blur, float fract, uint8_t* dst, int n) {
+    const __m128 factor = _mm_set1_ps(fract);
+    
+    auto sharpen = [&](int k) {
+        __m128i s = load_u8x4(src + k);
+        __m128 diff = _mm_cvtepi32_ps(_mm_sub_epi32(s, load_u8x4(blur + k)));
+        return _mm_add_epi32(s, _mm_cvttps_epi32(_mm_mul_ps(diff, factor)));
+    };
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i out = pack_bytes(sharpen(j), sharpen(j + 4), sharpen(j + 8), sharpen(j + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j), out);
+    }
+    tail.unsharp_combine(src + j, blur + j, fract, dst + j, n - j);
+}
+
+void linear_trc(uint8_t* row, int n, int minval, int diff, float factor) {
+    const __m128i low = _mm_set1_epi32(minval);
+    const __m128i range = _mm_set1_epi32(diff);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i white = _mm_set1_epi32(255);
+    const __m128 scale = _mm_set1_ps(factor);
+    const __m128 half = _mm_set1_ps(0.5f);
+    
+    auto stretch = [&](int k) {
+        __m128i offset = _mm_sub_epi32(load_u8x4(row + k), low);
+        __m128i value = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(scale, _mm_cvtepi32_ps(offset)), half));
+        value = _mm_blendv_epi8(value, white, _mm_cmpgt_epi32(offset, range));
+        return _mm_blendv_epi8(value, zero, _mm_cmplt_epi32(offset, one));
+    };
+    
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i out = pack_bytes(stretch(j), stretch(j + 4), stretch(j + 8), stretch(j + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + j), out);
+    }
+    tail.linear_trc(row + j, n - j, minval, diff, factor);
+}
+
+void threshold_to_bits(const uint8_t* row, int n, int thresh, uint32_t* dst) {
+    if (thresh <= 0 || thresh > 255) {
+        tail.threshold_to_bits(row, n, thresh, dst);
+        return;
+    }
+    
+    // Byte order reversed so the first pixel lands in the top bit of the movemask
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i limit = _mm_set1_epi8(char(thresh - 1));
+    auto below = [&](int k) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + k));
+        __m128i mask = _mm_cmpeq_epi8(_mm_min_epu8(v, limit), v);
+        return uint32_t(_mm_movemask_epi8(_mm_shuffle_epi8(mask, reverse)));
+    };
+    
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        dst[j / 32] = (below(j) << 16) | below(j + 16);
+    }
+    tail.threshold_to_bits(row + j, n - j, thresh, dst + j / 32);
+}
+
+}  // namespace
+
+const KernelTable& sse41_kernels() {
+    static const KernelTable table = {
+        "sse4", rgb_to_gray, swap_words, column_update, box_normalize,
+        unsharp_combine, linear_trc, tail.histogram, threshold_to_bits
+    };
+    return table;
+}
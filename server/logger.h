@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// Asynchronous structured logger.
+//
+// Worker threads only copy a fixed-size record into a lock-free ring; a
+// background thread formats the records as JSON lines and writes them in
+// batches. When the ring is full records are dropped and counted instead
+// of blocking the caller.
+
+enum class LogLevel : uint8_t { Debug, Info, Warn, Error };
+
+// One key/value pair of a record. Keys must be string literals, string
+// values are copied and truncated to fit the record.
+struct LogField {
+    enum class Type : uint8_t { Int, Double, Str };
+    
+    static constexpr size_t max_str = 47;
+    
+    const char* key;
+    Type type;
+    uint8_t len;
+    union {
+        int64_t i;
+        double d;
+    };
+    char s[max_str + 1];
+    
+    LogField() : key(""), type(Type::Int), len(0), i(0) {}
+    
+    template <typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+    LogField(const char* key, T value) : key(key), type(Type::Int), len(0), i(static_cast<int64_t>(value)) {}
+    
+    LogField(const char* key, double value) : key(key), type(Type::Double), len(0), d(value) {}
+    
+    LogField(const char* key, std::string_view value) : key(key), type(Type::Str), i(0) {
+        len = static_cast<uint8_t>(std::min(value.size(), max_str));
+        std::memcpy(s, value.data(), len);
+    }
+    
+    LogField(const char* key, const char* value) : LogField(key, std::string_view(value)) {}
+    LogField(const char* key, const std::string& value) : LogField(key, std::string_view(value)) {}
+};
+
+struct LogRecord {
+    static constexpr size_t max_fields = 8;
+    
+    int64_t timestamp_ns;  // system_clock, for the wall-clock stamp
+    uint32_t thread;
+    LogLevel level;
+    uint8_t num_fields;
+    const char* event;     // Must be a string literal
+    LogField fields[max_fields];
+};
+
+class Logger {
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        LogRecord record;
+    };
+    
+    // Bounded MPSC ring (Vyukov-style sequence numbers)
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) size_t tail;  // Only touched by the flusher
+    
+    std::atomic<LogLevel> min_level;
+    std::atomic<uint64_t> dropped;
+    
+    // Token bucket for per-request lines, refilled once per second
+    std::atomic<int64_t> rate_limit;  // Lines per second, 0 = unlimited
+    std::atomic<int64_t> tokens;
+    std::atomic<int64_t> bucket_second;
+    std::atomic<uint64_t> suppressed;
+    
+    std::FILE* out;
+    std::atomic<bool> running;
+    std::thread flusher;
+    
+    static uint32_t thread_index() {
+        static std::atomic<uint32_t> next{0};
+        thread_local uint32_t index = next.fetch_add(1);
+        return index;
+    }
+    
+    static const char* level_name(LogLevel level) {
+        switch (level) {
+            case LogLevel::Debug: return "debug";
+            case LogLevel::Info:  return "info";
+            case LogLevel::Warn:  return "warn";
+            case LogLevel::Error: return "error";
+        }
+        return "info";
+    }
+    
+    static void append_escaped(std::string& buf, const char* s, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            switch (c) {
+                case '"':  buf += "\\\""; break;
+                case '\\': buf += "\\\\"; break;
+                case '\n': buf += "\\n"; break;
+                case '\r': buf += "\\r"; break;
+                case '\t': buf += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char hex[8];
+                        std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+                        buf += hex;
+                    } else {
+                        buf += static_cast<char>(c);
+                    }
+            }
+        }
+    }
+    
+    static void format(std::string& buf, const LogRecord& r) {
+        std::time_t secs = static_cast<std::time_t>(r.timestamp_ns / 1000000000);
+        std::tm tm;
+        gmtime_r(&secs, &tm);
+        char stamp[48];
+        size_t n = std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+        std::snprintf(stamp + n, sizeof(stamp) - n, ".%06lldZ",
+                      static_cast<long long>((r.timestamp_ns / 1000) % 1000000));
+        
+        buf += "{\"ts\":\"";
+        buf += stamp;
+        buf += "\",\"level\":\"";
+        buf += level_name(r.level);
+        buf += "\",\"thread\":";
+        buf += std::to_string(r.thread);
+        buf += ",\"event\":\"";
+        append_escaped(buf, r.event, std::strlen(r.event));
+        buf += '"';
+        
+        for (uint8_t f = 0; f < r.num_fields; ++f) {
+            const LogField& field = r.fields[f];
+            buf += ",\"";
+            append_escaped(buf, field.key, std::strlen(field.key));
+            buf += "\":";
+            if (field.type == LogField::Type::Int) {
+                buf += std::to_string(field.i);
+            } else if (field.type == LogField::Type::Double) {
+                char num[32];
+                std::snprintf(num, sizeof(num), "%.3f", field.d);
+                buf += num;
+            } else {
+                buf += '"';
+                append_escaped(buf, field.s, field.len);
+                buf += '"';
+            }
+        }
+        buf += "}\n";
+    }
+    
+    bool try_pop(LogRecord& record) {
+        Slot& slot = slots[tail & mask];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1) return false;
+        record = slot.record;
+        slot.seq.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+        return true;
+    }
+    
+    // Drains everything currently in the ring with a single write
+    void drain(std::string& buf) {
+        LogRecord record;
+        buf.clear();
+        while (try_pop(record)) {
+            format(buf, record);
+        }
+        
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        uint64_t limited = suppressed.exchange(0, std::memory_order_relaxed);
+        if (lost || limited) {
+            buf += "{\"level\":\"warn\",\"event\":\"log_lines_lost\",\"dropped\":" + std::to_string(lost) +
+                   ",\"rate_limited\":" + std::to_string(limited) + "}\n";
+        }
+        
+        if (!buf.empty()) {
+            std::fwrite(buf.data(), 1, buf.size(), out);
+            std::fflush(out);
+        }
+    }
+    
+    void run() {
+        std::string buf;
+        buf.reserve(64 * 1024);
+        while (running.load(std::memory_order_acquire)) {
+            drain(buf);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        drain(buf);
+    }
+    
+public:
+    explicit Logger(size_t capacity = 4096, std::FILE* out = stdout)
+        : head(0), tail(0), min_level(LogLevel::Info), dropped(0), rate_limit(0),
+          tokens(0), bucket_second(0), suppressed(0), out(out), running(true) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots = std::make_unique<Slot[]>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        flusher = std::thread([this] { run(); });
+    }
+    
+    ~Logger() {
+        running.store(false, std::memory_order_release);
+        flusher.join();
+    }
+    
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    
+    void set_level(LogLevel level) { min_level.store(level, std::memory_order_relaxed); }
+    
+    // Caps lines logged through request(); 0 removes the cap
+    void set_request_rate(int64_t lines_per_second) {
+        rate_limit.store(lines_per_second, std::memory_order_relaxed);
+    }
+    
+    bool enabled(LogLevel level) const {
+        return level >= min_level.load(std::memory_order_relaxed);
+    }
+    
+    void log(LogLevel level, const char* event, std::initializer_list<LogField> fields = {}) {
+        if (!enabled(level)) return;
+        
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        
+        LogRecord& r = slot->record;
+        r.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        r.thread = thread_index();
+        r.level = level;
+        r.event = event;
+        r.num_fields = 0;
+        for (const LogField& field : fields) {
+            if (r.num_fields == LogRecord::max_fields) break;
+            r.fields[r.num_fields++] = field;
+        }
+        slot->seq.store(pos + 1, std::memory_order_release);
+    }
+    
+    // Per-request lines: same as log() but subject to the rate limit
+    void request(LogLevel level, const char* event, std::initializer_list<LogField> fields = {}) {
+        if (!enabled(level)) return;
+        
+        int64_t limit = rate_limit.load(std::memory_order_relaxed);
+        if (limit > 0) {
+            int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t second = bucket_second.load(std::memory_order_relaxed);
+            if (now != second && bucket_second.compare_exchange_strong(second, now)) {
+                tokens.store(limit, std::memory_order_relaxed);
+            }
+            if (tokens.fetch_sub(1, std::memory_order_relaxed) <= 0) {
+                suppressed.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        log(level, event, fields);
+    }
+};
+
+// Process-wide logger
+inline Logger& logger() {
+    static Logger instance;
+    return instance;
+}
@@ -0,0 +1,1438 @@
+#include "ocr_core.h"
+#include "kernels.h"
+#include "logger.h"
+#include <tesseract/ocrclass.h>
+#include <tesseract/resultiterator.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <utility>
+
+namespace ocr_core {
+
+namespace {
+
+// Stages switched to the kernels by init_kernels()
+std::atomic<bool> fast_grayscale{false};
+std::atomic<bool> fast_unsharp{false};
+std::atomic<bool> fast_contrast{false};
+std::atomic<bool> fast_binarize{false};
+
+std::atomic<Preprocess> preprocess_mode{Preprocess::Adaptive};
+std::atomic<Split> split_mode{Split::Page};
+
+// Set once at startup by set_whitelist()
+Whitelist text_whitelist;
+
+// Parameters shared by the Leptonica and kernel versions of each stage
+constexpr int unsharp_halfwidth = 5;
+constexpr float unsharp_fract = 2.5f;
+constexpr int contrast_tile = 50;
+constexpr int contrast_mindiff = 130;
+constexpr int contrast_smooth = 2;
+constexpr int background_tile = 10;
+constexpr int background_thresh = 100;
+constexpr int background_mincount = 50;
+constexpr int background_value = 10;
+constexpr int background_smooth = 10;
+constexpr float otsu_scorefract = 0.1f;
+
+// Adaptive preprocessing: rows sampled by analyze() and the limits
+// plan_preprocessing() applies to its statistics
+constexpr int analyze_rows = 256;
+constexpr float clean_bimodality = 0.85f;
+constexpr float clean_contrast = 100.0f;
+constexpr float clean_noise = 4.0f;
+constexpr float sharpen_max_noise = 12.0f;
+constexpr float legible_stroke = 3.0f;
+
+// Splitting: smaller pages are recognized whole, regions are cut with a
+// margin so strokes touching their boxes stay intact
+constexpr int split_min_pixels = 1000 * 1000;
+constexpr int region_padding = 4;
+
+// Pages whose mean word confidence falls below this get a second look, at
+// the words below it. Each word costs a Tesseract call of its own, so only
+// the weakest few are read again, however noisy the page.
+constexpr int fallback_confidence = 60;
+constexpr size_t fallback_max_regions = 16;
+
+// Buffer for one 8 bpp row in linear pixel order, padded to whole words
+std::vector<uint32_t> row_buffer(int width) {
+    return std::vector<uint32_t>((width + 3) / 4, 0);
+}
+
+inline uint8_t* bytes(std::vector<uint32_t>& row) {
+    return reinterpret_cast<uint8_t*>(row.data());
+}
+
+// Leptonica keeps 8 bpp pixels in 32-bit words with the first pixel in the
+// top byte, so on little-endian hosts rows are byte-swapped in and out
+void load_row(const KernelTable& k, Pix* pix, int y, uint32_t* row) {
+    const l_uint32* line = pixGetData(pix) + y * pixGetWpl(pix);
+    int nwords = (pixGetWidth(pix) + 3) / 4;
+    if constexpr (std::endian::native == std::endian::little) {
+        k.swap_words(line, row, nwords);
+    } else {
+        std::memcpy(row, line, nwords * sizeof(uint32_t));
+    }
+}
+
+void store_row(const KernelTable& k, const uint32_t* row, Pix* pix, int y) {
+    l_uint32* line = pixGetData(pix) + y * pixGetWpl(pix);
+    int nwords = (pixGetWidth(pix) + 3) / 4;
+    if constexpr (std::endian::native == std::endian::little) {
+        k.swap_words(row, line, nwords);
+    } else {
+        std::memcpy(line, row, nwords * sizeof(uint32_t));
+    }
+}
+
+// pixConvertTo8() on a 32 bpp image: luminance with Leptonica's weights
+Pix* kernel_grayscale(Pix* image) {
+    const KernelTable& k = kernels::active();
+    int w = pixGetWidth(image);
+    int h = pixGetHeight(image);
+    Pix* gray = pixCreate(w, h, 8);
+    if (!gray) return nullptr;
+    pixCopyResolution(gray, image);
+    
+    std::vector<uint32_t> row = row_buffer(w);
+    const l_uint32* data = pixGetData(image);
+    int wpl = pixGetWpl(image);
+    for (int y = 0; y < h; ++y) {
+        k.rgb_to_gray(data + y * wpl, bytes(row), w);
+        store_row(k, row.data(), gray, y);
+    }
+    return gray;
+}
+
+// pixUnsharpMaskingGray() for halfwidths above 2, one output row at a time:
+// a box blur from pixBlockconvGray(), including its edge renormalization,
+// then src + (src - blur) * fract clamped to 8 bits.
+//
+// The blur keeps a running sum of each column over the window rows and a
+// prefix sum along the row, so every pixel costs a constant number of
+// operations. Like Leptonica's accumulator image, windows touching the top
+// or left edge leave out row or column 0 and are rescaled afterwards.
+//
+// Source rows are pulled on demand into a ring of the 2 * halfwidth + 2
+// rows the window spans, so the whole image is never held.
+class UnsharpStream {
+private:
+    using Source = std::function<void(int y, uint8_t* row)>;
+    
+    const KernelTable& k;
+    const int w, h, wc, hc, fwc, fhc;
+    const float norm, fract;
+    Source source;
+    
+    const int stride;     // Words per ring row
+    const int ring_rows;
+    std::vector<uint32_t> ring;
+    int fetched = 0;      // Source rows pulled so far
+    int next_row = 0;     // Next output row
+    
+    std::vector<uint16_t> colsum;
+    std::vector<uint32_t> prefix;
+    std::vector<uint8_t> blur;
+    
+    const uint8_t* row(int y) {
+        while (fetched <= y) {
+            source(fetched, reinterpret_cast<uint8_t*>(ring.data() + size_t(fetched % ring_rows) * stride));
+            fetched++;
+        }
+        return reinterpret_cast<const uint8_t*>(ring.data() + size_t(y % ring_rows) * stride);
+    }
+    
+public:
+    UnsharpStream(const KernelTable& k, int width, int height, int halfwidth, float fract, Source source)
+        : k(k), w(width), h(height), wc(halfwidth), hc(halfwidth), fwc(2 * wc + 1), fhc(2 * hc + 1),
+          norm(1.0 / (float(fwc) * fhc)), fract(fract), source(std::move(source)),
+          stride((width + 3) / 4), ring_rows(2 * halfwidth + 2), ring(size_t(stride) * ring_rows, 0),
+          colsum(width, 0), prefix(width), blur(width) {
+        for (int y = 1; y <= std::min(hc, h - 1); ++y) {
+            k.column_update(colsum.data(), row(y), nullptr, w);
+        }
+    }
+    
+    // Writes the next sharpened row, in linear pixel order
+    void next(uint8_t* out) {
+        const int i = next_row++;
+        if (i > 0) {
+            // Fetching row i + hc only recycles rows older than i - 1 - hc
+            const uint8_t* add = i + hc <= h - 1 ? row(i + hc) : nullptr;
+            const uint8_t* sub = i - 1 - hc >= 1 ? row(i - 1 - hc) : nullptr;
+            k.column_update(colsum.data(), add, sub, w);
+        }
+        
+        uint32_t running = 0;
+        for (int j = 0; j < w; ++j) {
+            running += colsum[j];
+            prefix[j] = running;
+        }
+        
+        // Interior columns vectorized, the clipped ones at either end scalar
+        k.box_normalize(prefix.data() + fwc, prefix.data(), norm, blur.data() + wc + 1, w - fwc);
+        for (int j = 0; j < w; ++j) {
+            if (j == wc + 1) j = std::max(j, w - wc);
+            int jmin = std::max(j - 1 - wc, 0);
+            int jmax = std::min(j + wc, w - 1);
+            blur[j] = uint8_t(int(norm * float(int(prefix[jmax] - prefix[jmin])) + 0.5f));
+        }
+        
+        // Edge renormalization
+        bool edge_row = i <= hc || i >= h - hc;
+        float normh = 1.0f;
+        if (i <= hc) normh = float(fhc) / float(std::max(1, hc + i));
+        else if (i >= h - hc) normh = float(fhc) / float(hc + h - i);
+        for (int j = 0; j < w; ++j) {
+            if (j == wc + 1 && !edge_row) j = std::max(j, w - wc);
+            float value = float(blur[j]);
+            if (edge_row) value = value * normh;
+            if (j <= wc) value = value * (float(fwc) / float(std::max(1, wc + j)));
+            else if (j >= w - wc) value = value * (float(fwc) / float(wc + w - j));
+            blur[j] = uint8_t(std::min(value, 255.0f));
+        }
+        
+        k.unsharp_combine(row(i), blur.data(), fract, out, w);
+    }
+};
+
+Pix* kernel_unsharp(Pix* gray, int halfwidth, float fract) {
+    const KernelTable& k = kernels::active();
+    const int w = pixGetWidth(gray);
+    const int h = pixGetHeight(gray);
+    Pix* sharpened = pixCreate(w, h, 8);
+    if (!sharpened) return nullptr;
+    
+    UnsharpStream stream(k, w, h, halfwidth, fract, [&k, gray](int y, uint8_t* row) {
+        load_row(k, gray, y, reinterpret_cast<uint32_t*>(row));
+    });
+    std::vector<uint32_t> out = row_buffer(w);
+    for (int i = 0; i < h; ++i) {
+        stream.next(bytes(out));
+        store_row(k, out.data(), sharpened, i);
+    }
+    return sharpened;
+}
+
+// pixContrastNorm(): tile min/max maps from Leptonica, the per-tile linear
+// stretch of pixLinearTRCTiled() on the kernels
+Pix* kernel_contrast(Pix* gray, int sx, int sy, int mindiff, int smoothx, int smoothy) {
+    Pix* pixmin = nullptr;
+    Pix* pixmax = nullptr;
+    if (pixMinMaxTiles(gray, sx, sy, mindiff, smoothx, smoothy, &pixmin, &pixmax) != 0) {
+        pixDestroy(&pixmin);
+        pixDestroy(&pixmax);
+        return nullptr;
+    }
+    
+    int tiles_x = pixGetWidth(pixmin);
+    int tiles_y = pixGetHeight(pixmin);
+    std::vector<uint8_t> mins(tiles_x * tiles_y);
+    std::vector<uint8_t> maxs(tiles_x * tiles_y);
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            l_uint32 lo = 0;
+            l_uint32 hi = 0;
+            pixGetPixel(pixmin, tx, ty, &lo);
+            pixGetPixel(pixmax, tx, ty, &hi);
+            mins[ty * tiles_x + tx] = uint8_t(lo);
+            maxs[ty * tiles_x + tx] = uint8_t(hi);
+        }
+    }
+    pixDestroy(&pixmin);
+    pixDestroy(&pixmax);
+    
+    Pix* stretched = pixCopy(NULL, gray);
+    if (!stretched) return nullptr;
+    
+    const KernelTable& k = kernels::active();
+    int w = pixGetWidth(gray);
+    int h = pixGetHeight(gray);
+    std::vector<uint32_t> row = row_buffer(w);
+    for (int y = 0; y < h && y / sy < tiles_y; ++y) {
+        load_row(k, stretched, y, row.data());
+        const int ty = y / sy;
+        for (int tx = 0; tx < tiles_x && tx * sx < w; ++tx) {
+            int minval = mins[ty * tiles_x + tx];
+            int diff = maxs[ty * tiles_x + tx] - minval;
+            if (diff <= 0) continue;  // Leptonica leaves flat tiles untouched
+            float factor = 255.0 / float(diff);
+            k.linear_trc(bytes(row) + tx * sx, std::min(sx, w - tx * sx), minval, diff, factor);
+        }
+        store_row(k, row.data(), stretched, y);
+    }
+    return stretched;
+}
+
+// numaSplitDistribution() on a gray histogram, in the same float
+// arithmetic: the split maximizing the between-class score, moved to the
+// histogram minimum among neighbours scoring within scorefract of the best,
+// plus one since thresholding keeps values below the threshold.
+int otsu_threshold(const uint32_t* hist, float scorefract) {
+    constexpr int n = 256;
+    float sum = 0.0f;
+    float moment = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        float count = float(hist[i]);
+        sum += count;
+        moment += float(i) * count;
+    }
+    if (sum <= 0.0f) return 0;
+    
+    const float norm = 4.0 / (float(n - 1) * (n - 1));
+    float ave1prev = 0.0f;
+    float ave2prev = moment / sum;
+    float num1prev = 0.0f;
+    float num2prev = sum;
+    float maxscore = 0.0f;
+    int maxindex = n / 2;
+    float scores[n];
+    
+    for (int i = 0; i < n; ++i) {
+        float val = float(hist[i]);
+        float num1 = num1prev + val;
+        float ave1 = num1 == 0 ? ave1prev : (num1prev * ave1prev + i * val) / num1;
+        float num2 = num2prev - val;
+        float ave2 = num2 == 0 ? ave2prev : (num2prev * ave2prev - i * val) / num2;
+        float fract1 = num1 / sum;
+        float score = norm * (fract1 * (1 - fract1)) * (ave2 - ave1) * (ave2 - ave1);
+        scores[i] = score;
+        if (score > maxscore) {
+            maxscore = score;
+            maxindex = i;
+        }
+        num1prev = num1;
+        num2prev = num2;
+        ave1prev = ave1;
+        ave2prev = ave2;
+    }
+    
+    float minscore = (1. - scorefract) * maxscore;
+    int lo = maxindex - 1;
+    while (lo >= 0 && scores[lo] >= minscore) lo--;
+    int hi = maxindex + 1;
+    while (hi < n && scores[hi] >= minscore) hi++;
+    
+    int best = lo + 1;
+    for (int i = lo + 2; i <= hi - 1; ++i) {
+        if (hist[i] < hist[best]) best = i;
+    }
+    return std::min(255, best + 1);
+}
+
+// pixThresholdToBinary(): pixels darker than thresh become foreground
+Pix* kernel_threshold(Pix* gray, int thresh) {
+    const KernelTable& k = kernels::active();
+    int w = pixGetWidth(gray);
+    int h = pixGetHeight(gray);
+    Pix* binary = pixCreate(w, h, 1);
+    if (!binary) return nullptr;
+    
+    pixCopyResolution(binary, gray);
+    l_uint32* data = pixGetData(binary);
+    int wpl = pixGetWpl(binary);
+    std::vector<uint32_t> row = row_buffer(w);
+    for (int y = 0; y < h; ++y) {
+        load_row(k, gray, y, row.data());
+        k.threshold_to_bits(bytes(row), w, thresh, data + y * wpl);
+    }
+    return binary;
+}
+
+// pixOtsuThreshOnBackgroundNorm(): background normalization from
+// Leptonica, then one global Otsu threshold from a kernel histogram
+Pix* kernel_binarize(Pix* gray) {
+    Pix* normalized = pixBackgroundNorm(gray, NULL, NULL, background_tile, background_tile,
+                                        background_thresh, background_mincount, background_value,
+                                        background_smooth, background_smooth);
+    if (!normalized) return nullptr;
+    
+    const KernelTable& k = kernels::active();
+    int w = pixGetWidth(normalized);
+    int h = pixGetHeight(normalized);
+    std::vector<uint32_t> row = row_buffer(w);
+    uint32_t hist[256] = {};
+    for (int y = 0; y < h; ++y) {
+        load_row(k, normalized, y, row.data());
+        k.histogram(bytes(row), w, hist);
+    }
+    
+    Pix* binary = kernel_threshold(normalized, otsu_threshold(hist, otsu_scorefract));
+    pixDestroy(&normalized);
+    return binary;
+}
+
+// Contrast maps the way pixContrastNorm() builds them, on per-tile minima
+// and maxima: tiles spanning less than mindiff take the values of the
+// nearest usable tile in their row, rows with none copy the nearest usable
+// row, then both maps are box-smoothed over (2 * smooth + 1)^2 tiles. With
+// no usable tile at all both maps become 0, which leaves pixels unchanged.
+void build_contrast_maps(std::vector<uint8_t>& mins, std::vector<uint8_t>& maxs,
+                         int tiles_x, int tiles_y, int mindiff, int smooth) {
+    auto usable = [&](int t) { return maxs[t] - mins[t] >= mindiff; };
+    
+    std::vector<bool> row_usable(tiles_y, false);
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        const int base = ty * tiles_x;
+        std::vector<int> nearest(tiles_x, -1);
+        int last = -1;
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            if (usable(base + tx)) last = tx;
+            nearest[tx] = last;
+        }
+        last = -1;
+        for (int tx = tiles_x - 1; tx >= 0; --tx) {
+            if (usable(base + tx)) last = tx;
+            if (last >= 0 && (nearest[tx] < 0 || last - tx < tx - nearest[tx])) nearest[tx] = last;
+        }
+        if (nearest[0] < 0) continue;
+        row_usable[ty] = true;
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            mins[base + tx] = mins[base + nearest[tx]];
+            maxs[base + tx] = maxs[base + nearest[tx]];
+        }
+    }
+    
+    if (std::find(row_usable.begin(), row_usable.end(), true) == row_usable.end()) {
+        std::fill(mins.begin(), mins.end(), 0);
+        std::fill(maxs.begin(), maxs.end(), 0);
+        return;
+    }
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        if (row_usable[ty]) continue;
+        int from = -1;
+        for (int d = 1; from < 0; ++d) {
+            if (ty - d >= 0 && row_usable[ty - d]) from = ty - d;
+            else if (ty + d < tiles_y && row_usable[ty + d]) from = ty + d;
+        }
+        std::copy_n(mins.begin() + from * tiles_x, tiles_x, mins.begin() + ty * tiles_x);
+        std::copy_n(maxs.begin() + from * tiles_x, tiles_x, maxs.begin() + ty * tiles_x);
+    }
+    
+    if (smooth <= 0) return;
+    auto box_smooth = [&](std::vector<uint8_t>& map) {
+        std::vector<uint8_t> smoothed(map.size());
+        for (int ty = 0; ty < tiles_y; ++ty) {
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                int sum = 0;
+                int count = 0;
+                for (int y = std::max(0, ty - smooth); y <= std::min(tiles_y - 1, ty + smooth); ++y) {
+                    for (int x = std::max(0, tx - smooth); x <= std::min(tiles_x - 1, tx + smooth); ++x) {
+                        sum += map[y * tiles_x + x];
+                        count++;
+                    }
+                }
+                smoothed[ty * tiles_x + tx] = uint8_t((sum + count / 2) / count);
+            }
+        }
+        map.swap(smoothed);
+    };
+    box_smooth(mins);
+    box_smooth(maxs);
+}
+
+// Decodes the UTF-8 sequence at p, returning its length, or 0 when it is
+// truncated, overlong, a surrogate or past U+10FFFF
+size_t decode_utf8(const unsigned char* p, size_t left, char32_t& c) {
+    size_t length;
+    char32_t min;
+    if (p[0] < 0x80) {
+        c = p[0];
+        return 1;
+    } else if (p[0] >= 0xc2 && p[0] < 0xe0) {
+        c = p[0] & 0x1f;
+        length = 2;
+        min = 0x80;
+    } else if (p[0] >= 0xe0 && p[0] < 0xf0) {
+        c = p[0] & 0x0f;
+        length = 3;
+        min = 0x800;
+    } else if (p[0] >= 0xf0 && p[0] < 0xf5) {
+        c = p[0] & 0x07;
+        length = 4;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+    if (length > left) return 0;
+    for (size_t i = 1; i < length; ++i) {
+        if ((p[i] & 0xc0) != 0x80) return 0;
+        c = (c << 6) | (p[i] & 0x3f);
+    }
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c < 0xe000)) return 0;
+    return length;
+}
+
+// How normalize_text() treats a code point
+enum class CharClass { Keep, Space, Newline, Drop };
+
+CharClass classify(char32_t c) {
+    if (c == '\n' || c == '\v' || c == '\f' || c == 0x2028 || c == 0x2029) return CharClass::Newline;
+    if (c == ' ' || c == '\t' || c == 0xa0 || c == 0x1680 || (c >= 0x2000 && c <= 0x200a) ||
+        c == 0x202f || c == 0x205f || c == 0x3000) {
+        return CharClass::Space;
+    }
+    // C0 and C1 controls (\r included), DEL, zero-width space and BOM
+    if (c < 0x20 || (c >= 0x7f && c < 0xa0) || c == 0x200b || c == 0xfeff) return CharClass::Drop;
+    return CharClass::Keep;
+}
+
+// Parses a hex code point, optionally written "U+XXXX"
+bool parse_code_point(std::string_view text, char32_t& c) {
+    if (text.starts_with("U+") || text.starts_with("u+")) text.remove_prefix(2);
+    if (text.empty() || text.size() > 6) return false;
+    c = 0;
+    for (char ch : text) {
+        int digit = ch >= '0' && ch <= '9' ? ch - '0'
+                  : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10
+                  : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10 : -1;
+        if (digit < 0) return false;
+        c = (c << 4) | char32_t(digit);
+    }
+    return c <= 0x10ffff;
+}
+
+void allow_range(Whitelist& whitelist, char32_t first, char32_t last) {
+    for (; first <= last && first < 0x80; ++first) {
+        whitelist.ascii[first / 64] |= uint64_t(1) << (first % 64);
+    }
+    if (first <= last) whitelist.ranges.emplace_back(first, last);
+}
+
+// Crop of one layout region with a margin around it
+Pix* crop_region(Pix* image, int x, int y, int w, int h) {
+    Box* padded = boxCreate(std::max(0, x - region_padding), std::max(0, y - region_padding),
+                            w + 2 * region_padding, h + 2 * region_padding);
+    Pix* crop = pixClipRectangle(image, padded, nullptr);
+    boxDestroy(&padded);
+    return crop;
+}
+
+bool has_magic(const uint8_t* data, size_t size, std::string_view magic) {
+    return size >= magic.size() && std::memcmp(data, magic.data(), magic.size()) == 0;
+}
+
+bool is_tiff(const uint8_t* data, size_t size) {
+    return has_magic(data, size, std::string_view("II*\0", 4)) || has_magic(data, size, std::string_view("MM\0*", 4));
+}
+
+bool is_plain_gray(Pix* pix) {
+    return pixGetDepth(pix) == 8 && !pixGetColormap(pix);
+}
+
+// Same pixels and resolution
+bool same_image(Pix* a, Pix* b) {
+    l_int32 same = 0;
+    return a && b && pixEqual(a, b, &same) == 0 && same &&
+           pixGetXRes(a) == pixGetXRes(b) && pixGetYRes(a) == pixGetYRes(b);
+}
+
+}  // namespace
+
+KernelReport init_kernels(const std::string& variant) {
+    fast_grayscale = fast_unsharp = fast_contrast = fast_binarize = false;
+    
+    KernelReport report;
+    if (variant == "off" || !kernels::select(variant)) {
+        report.variant = "off";
+        return report;
+    }
+    report.variant = kernels::active().name;
+    
+    // Odd sizes exercise the vector tails and partial tiles
+    report.grayscale = report.unsharp = report.contrast = report.binarize = true;
+    const std::pair<int, int> sizes[] = {{523, 257}, {1241, 877}, {64, 801}};
+    uint32_t seed = 1;
+    for (auto [width, height] : sizes) {
+        Pix* color = make_test_page(width, height, seed++);
+        pixSetResolution(color, 300, 300);
+        
+        Pix* gray = to_grayscale(color, Impl::Leptonica);
+        Pix* candidate = kernel_grayscale(color);
+        report.grayscale = report.grayscale && same_image(gray, candidate);
+        pixDestroy(&candidate);
+        
+        Pix* sharpened = unsharp(gray, Impl::Leptonica);
+        candidate = kernel_unsharp(gray, unsharp_halfwidth, unsharp_fract);
+        report.unsharp = report.unsharp && same_image(sharpened, candidate);
+        pixDestroy(&candidate);
+        
+        Pix* contrast = normalize_contrast(sharpened, Impl::Leptonica);
+        candidate = kernel_contrast(sharpened, contrast_tile, contrast_tile, contrast_mindiff,
+                                    contrast_smooth, contrast_smooth);
+        report.contrast = report.contrast && same_image(contrast, candidate);
+        pixDestroy(&candidate);
+        
+        Pix* binary = binarize(contrast, Impl::Leptonica);
+        candidate = kernel_binarize(contrast);
+        report.binarize = report.binarize && same_image(binary, candidate);
+        pixDestroy(&candidate);
+        
+        pixDestroy(&binary);
+        pixDestroy(&contrast);
+        pixDestroy(&sharpened);
+        pixDestroy(&gray);
+        pixDestroy(&color);
+    }
+    
+    fast_grayscale = report.grayscale;
+    fast_unsharp = report.unsharp;
+    fast_contrast = report.contrast;
+    fast_binarize = report.binarize;
+    return report;
+}
+
+Pix* make_test_page(int width, int height, uint32_t seed) {
+    Pix* page = pixCreate(width, height, 32);
+    l_uint32* data = pixGetData(page);
+    int wpl = pixGetWpl(page);
+    auto next_random = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    
+    // Paper darkens towards the bottom right so contrast tiles differ
+    int line_height = std::max(12, height / 50);
+    for (int y = 0; y < height; ++y) {
+        l_uint32* line = data + y * wpl;
+        int in_line = y % (line_height * 2);
+        bool text_row = in_line > line_height / 4 && in_line < line_height;
+        for (int x = 0; x < width; ++x) {
+            uint32_t paper = 235 - 60 * (x + y) / (width + height);
+            uint32_t r = paper + next_random() % 20;
+            uint32_t g = paper + next_random() % 20;
+            uint32_t b = paper + next_random() % 20;
+            if (text_row && (x / (line_height * 4)) % 5 != 4 && (x % 7 < 2 || in_line == line_height / 2)) {
+                r = 20 + next_random() % 40;
+                g = 20 + next_random() % 40;
+                b = 30 + next_random() % 60;
+            }
+            line[x] = (r << 24) | (g << 16) | (b << 8);
+        }
+    }
+    return page;
+}
+
+bool OCREngine::init() {
+    shutdown();
+    api = std::make_unique<tesseract::TessBaseAPI>();
+    if (api->Init(tessdata_path, lang, tesseract::OEM_LSTM_ONLY)) {
+        api.reset();
+        return false;
+    }
+    ready = true;
+    jobs_done = 0;
+    return true;
+}
+
+void OCREngine::shutdown() {
+    if (api) {
+        api->End();
+        api.reset();
+    }
+    ready = false;
+}
+
+bool OCREngine::warm_up() {
+    if (!init()) return false;
+    
+    // White 8 bpp canvas with a couple of dark strokes
+    Pix* probe = pixCreate(96, 32, 8);
+    pixSetAll(probe);
+    for (int y = 8; y < 24; ++y) {
+        for (int x = 16; x < 20; ++x) pixSetPixel(probe, x, y, 0);
+        for (int x = 40; x < 44; ++x) pixSetPixel(probe, x, y, 0);
+    }
+    api->SetPageSegMode(tesseract::PSM_SINGLE_BLOCK);
+    api->SetImage(probe);
+    bool ok = api->Recognize(nullptr) == 0;
+    api->Clear();
+    pixDestroy(&probe);
+    
+    if (!ok) shutdown();
+    return ok;
+}
+
+bool OCREngine::healthy() const {
+    if (!ready || !api) return false;
+    const char* loaded = api->GetInitLanguagesAsString();
+    return loaded && std::string(loaded) == lang;
+}
+
+tesseract::TessBaseAPI* OCREngine::acquire() {
+    if (!healthy() && !init()) return nullptr;
+    api->SetPageSegMode(tesseract::PSM_SINGLE_BLOCK);
+    return api.get();
+}
+
+void OCREngine::release() {
+    if (!api) return;
+    api->Clear();
+    jobs_done++;
+}
+
+void OCREngine::mark_bad() {
+    logger().log(LogLevel::Warn, "engine_reinit", {{"jobs_done", jobs_done}});
+    shutdown();
+}
+
+int page_count(const uint8_t* data, size_t size) {
+    if (!is_tiff(data, size)) return 1;
+    
+    // Walks the directory chain without decoding any page
+    FILE* fp = fopenReadFromMemory(data, size);
+    if (!fp) return 1;
+    l_int32 count = 0;
+    if (tiffGetCount(fp, &count) != 0) count = 1;
+    fclose(fp);
+    return std::max(count, 1);
+}
+
+Pix* decode(const uint8_t* data, size_t size, int page) {
+    if (page == 0) return pixReadMem(data, size);
+    return is_tiff(data, size) ? pixReadMemTiff(data, size, page) : nullptr;
+}
+
+Pix* to_grayscale(Pix* image, Impl impl) {
+    if (impl == Impl::Auto && fast_grayscale && pixGetDepth(image) == 32) {
+        return kernel_grayscale(image);
+    }
+    return pixConvertTo8(image, false);
+}
+
+Pix* scale_to_minimum(Pix* gray, int min_width, int min_height) {
+    int w = pixGetWidth(gray);
+    int h = pixGetHeight(gray);
+    if (w >= min_width && h >= min_height) {
+        return pixClone(gray);
+    }
+    
+    float scale = std::max(float(min_width) / w, float(min_height) / h);
+    return pixScale(gray, scale, scale);
+}
+
+Pix* unsharp(Pix* gray, Impl impl) {
+    // Leptonica shrinks the blur window on images smaller than it
+    int window = 2 * unsharp_halfwidth + 1;
+    if (impl == Impl::Auto && fast_unsharp && is_plain_gray(gray) &&
+        pixGetWidth(gray) >= window && pixGetHeight(gray) >= window) {
+        return kernel_unsharp(gray, unsharp_halfwidth, unsharp_fract);
+    }
+    return pixUnsharpMaskingGray(gray, unsharp_halfwidth, unsharp_fract);
+}
+
+Pix* normalize_contrast(Pix* gray, Impl impl) {
+    if (impl == Impl::Auto && fast_contrast && is_plain_gray(gray)) {
+        return kernel_contrast(gray, contrast_tile, contrast_tile, contrast_mindiff,
+                               contrast_smooth, contrast_smooth);
+    }
+    return pixContrastNorm(NULL, gray, contrast_tile, contrast_tile, contrast_mindiff,
+                           contrast_smooth, contrast_smooth);
+}
+
+Pix* binarize(Pix* gray, Impl impl) {
+    if (impl == Impl::Auto && fast_binarize && is_plain_gray(gray)) {
+        return kernel_binarize(gray);
+    }
+    return pixOtsuThreshOnBackgroundNorm(gray, NULL, background_tile, background_tile,
+                                         background_thresh, background_mincount, background_value,
+                                         background_smooth, background_smooth, otsu_scorefract, NULL);
+}
+
+void set_preprocess(Preprocess mode) {
+    preprocess_mode = mode;
+}
+
+Pix* preprocess_fused(Pix* image) {
+    if ((pixGetDepth(image) != 8 && pixGetDepth(image) != 32) || pixGetColormap(image)) {
+        return nullptr;
+    }
+    
+    // Only small crops are upscaled and those are cheap to stage, which keeps
+    // resampling out of the streaming loop
+    Pix* source = nullptr;
+    if (pixGetWidth(image) < 500 || pixGetHeight(image) < 250) {
+        Pix* gray = to_grayscale(image);
+        source = gray ? scale_to_minimum(gray) : nullptr;
+        pixDestroy(&gray);
+    } else {
+        source = pixClone(image);
+    }
+    if (!source) return nullptr;
+    
+    const KernelTable& k = kernels::active();
+    const int w = pixGetWidth(source);
+    const int h = pixGetHeight(source);
+    const bool color = pixGetDepth(source) == 32;
+    auto gray_row = [&k, source, color, w](int y, uint8_t* row) {
+        if (color) {
+            k.rgb_to_gray(pixGetData(source) + y * pixGetWpl(source), row, w);
+        } else {
+            load_row(k, source, y, reinterpret_cast<uint32_t*>(row));
+        }
+    };
+    
+    // Pass 1: per-tile minimum, maximum and histogram of the sharpened image
+    const int tile = contrast_tile;
+    const int tiles_x = (w + tile - 1) / tile;
+    const int tiles_y = (h + tile - 1) / tile;
+    std::vector<uint8_t> mins(tiles_x * tiles_y, 255);
+    std::vector<uint8_t> maxs(tiles_x * tiles_y, 0);
+    std::vector<uint16_t> tile_hists(size_t(tiles_x) * tiles_y * 256, 0);  // At most 50 x 50 per bin
+    std::vector<uint32_t> row = row_buffer(w);
+    {
+        UnsharpStream sharpened(k, w, h, unsharp_halfwidth, unsharp_fract, gray_row);
+        for (int y = 0; y < h; ++y) {
+            sharpened.next(bytes(row));
+            const int ty = y / tile;
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                const uint8_t* segment = bytes(row) + tx * tile;
+                const int n = std::min(tile, w - tx * tile);
+                auto [lo, hi] = std::minmax_element(segment, segment + n);
+                const int t = ty * tiles_x + tx;
+                mins[t] = std::min(mins[t], *lo);
+                maxs[t] = std::max(maxs[t], *hi);
+                uint16_t* hist = tile_hists.data() + size_t(t) * 256;
+                for (int j = 0; j < n; ++j) hist[segment[j]]++;
+            }
+        }
+    }
+    build_contrast_maps(mins, maxs, tiles_x, tiles_y, contrast_mindiff, contrast_smooth);
+    
+    // The stretch is a per-tile lookup, so the histogram of the stretched
+    // image follows from the tile histograms without touching pixels
+    uint32_t hist[256] = {};
+    uint8_t ramp[256];
+    for (int t = 0; t < tiles_x * tiles_y; ++t) {
+        for (int v = 0; v < 256; ++v) ramp[v] = uint8_t(v);
+        int diff = maxs[t] - mins[t];
+        if (diff > 0) k.linear_trc(ramp, 256, mins[t], diff, 255.0 / float(diff));
+        const uint16_t* tile_hist = tile_hists.data() + size_t(t) * 256;
+        for (int v = 0; v < 256; ++v) hist[ramp[v]] += tile_hist[v];
+    }
+    tile_hists = {};
+    const int thresh = otsu_threshold(hist, otsu_scorefract);
+    
+    // Pass 2: sharpen again, stretch and threshold straight into 1 bpp
+    Pix* binary = pixCreate(w, h, 1);
+    if (binary) {
+        pixCopyResolution(binary, source);
+        l_uint32* data = pixGetData(binary);
+        const int wpl = pixGetWpl(binary);
+        UnsharpStream sharpened(k, w, h, unsharp_halfwidth, unsharp_fract, gray_row);
+        for (int y = 0; y < h; ++y) {
+            sharpened.next(bytes(row));
+            const int ty = y / tile;
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                const int t = ty * tiles_x + tx;
+                int diff = maxs[t] - mins[t];
+                if (diff <= 0) continue;
+                k.linear_trc(bytes(row) + tx * tile, std::min(tile, w - tx * tile), mins[t], diff, 255.0 / float(diff));
+            }
+            k.threshold_to_bits(bytes(row), w, thresh, data + y * wpl);
+        }
+    }
+    pixDestroy(&source);
+    return binary;
+}
+
+Pix* threshold(Pix* gray, int thresh, Impl impl) {
+    if (impl == Impl::Auto && fast_binarize && is_plain_gray(gray)) {
+        return kernel_threshold(gray, thresh);
+    }
+    return pixThresholdToBinary(gray, thresh);
+}
+
+ImageStats analyze(Pix* gray) {
+    ImageStats stats;
+    const KernelTable& k = kernels::active();
+    const int w = pixGetWidth(gray);
+    const int h = pixGetHeight(gray);
+    const int step = std::max(1, h / analyze_rows);
+    const int nrows = (h + step - 1) / step;
+    const int stride = (w + 3) / 4;
+    
+    std::vector<uint32_t> rows(size_t(nrows) * stride);
+    auto row = [&](int i) { return reinterpret_cast<const uint8_t*>(rows.data() + size_t(i) * stride); };
+    uint32_t hist[256] = {};
+    for (int i = 0; i < nrows; ++i) {
+        load_row(k, gray, i * step, rows.data() + size_t(i) * stride);
+        k.histogram(row(i), w, hist);
+    }
+    stats.threshold = otsu_threshold(hist, otsu_scorefract);
+    
+    // Two classes split at the threshold: their separation against the
+    // spread of the whole histogram
+    double count[2] = {};
+    double sum[2] = {};
+    double squares = 0;
+    for (int v = 0; v < 256; ++v) {
+        const int c = v >= stats.threshold;
+        count[c] += hist[v];
+        sum[c] += double(v) * hist[v];
+        squares += double(v) * v * hist[v];
+    }
+    const double total = count[0] + count[1];
+    if (count[0] == 0 || count[1] == 0) return stats;
+    const double mean = (sum[0] + sum[1]) / total;
+    const double variance = squares / total - mean * mean;
+    const double gap = sum[1] / count[1] - sum[0] / count[0];
+    stats.contrast = float(gap);
+    stats.bimodality = variance > 0 ? float(count[0] / total * (count[1] / total) * gap * gap / variance) : 1.0f;
+    
+    // Strokes are runs of the smaller class, whichever polarity the page
+    // has; noise is the step between neighbours that stay in one class
+    const int ink = count[0] <= count[1] ? 0 : 1;
+    double runs = 0;
+    double run_pixels = 0;
+    double steps = 0;
+    double pairs = 0;
+    for (int i = 0; i < nrows; ++i) {
+        const uint8_t* p = row(i);
+        int prev = -1;
+        for (int x = 0; x < w; ++x) {
+            const int c = p[x] >= stats.threshold;
+            if (c == ink) {
+                run_pixels++;
+                if (prev != ink) runs++;
+            }
+            if (c == prev) {
+                steps += std::abs(p[x] - p[x - 1]);
+                pairs++;
+            }
+            prev = c;
+        }
+    }
+    stats.stroke_width = runs > 0 ? float(run_pixels / runs) : 0.0f;
+    stats.noise = pairs > 0 ? float(steps / pairs) : 0.0f;
+    return stats;
+}
+
+PreprocessPlan plan_preprocessing(const ImageStats& stats, int width, int height) {
+    PreprocessPlan plan;
+    plan.scale = (width < 500 || height < 250) && stats.stroke_width < legible_stroke;
+    if (stats.bimodality >= clean_bimodality && stats.contrast >= clean_contrast && stats.noise <= clean_noise) {
+        // Already two flat levels: nothing to sharpen or stretch, and one
+        // global threshold separates them
+        plan.unsharp = false;
+        plan.contrast = false;
+        plan.global_threshold = true;
+    } else {
+        // Sharpening a grainy page mostly amplifies the grain
+        plan.unsharp = stats.noise <= sharpen_max_noise;
+    }
+    return plan;
+}
+
+Pix* preprocess(Pix* image, Preprocess mode, StageTimer& timer, std::string& path) {
+    if (mode == Preprocess::Fused) {
+        if (Pix* binary = preprocess_fused(image)) {
+            path = "fused";
+            timer.mark(Stage::Preprocess);
+            return binary;
+        }
+    }
+    
+    if (mode == Preprocess::Adaptive && pixGetDepth(image) == 1 && !pixGetColormap(image)) {
+        // Already binary: at most bring small crops up to size
+        path = "binary";
+        if (pixGetWidth(image) >= 500 && pixGetHeight(image) >= 250) return pixClone(image);
+        Pix* scaled = scale_to_minimum(image);
+        timer.mark(Stage::Scale);
+        if (!scaled) return pixClone(image);
+        path += ",scale";
+        return scaled;
+    }
+    
+    Pix* current = to_grayscale(image);
+    timer.mark(Stage::Grayscale);
+    if (!current) return pixClone(image);
+    path = "grayscale";
+    
+    PreprocessPlan plan;
+    int thresh = 0;
+    if (mode == Preprocess::Adaptive) {
+        ImageStats stats = analyze(current);
+        plan = plan_preprocessing(stats, pixGetWidth(current), pixGetHeight(current));
+        thresh = stats.threshold;
+        timer.mark(Stage::Analyze);
+    } else {
+        plan.scale = pixGetWidth(current) < 500 || pixGetHeight(current) < 250;
+    }
+    
+    // Each stage replaces current only when it succeeded
+    auto apply = [&](Pix* next, Stage stage, const char* name) {
+        timer.mark(stage);
+        if (!next) return;
+        pixDestroy(&current);
+        current = next;
+        path += ",";
+        path += name;
+    };
+    
+    if (plan.scale) apply(scale_to_minimum(current), Stage::Scale, "scale");
+    if (plan.unsharp) apply(unsharp(current), Stage::Unsharp, "unsharp");
+    if (plan.contrast) apply(normalize_contrast(current), Stage::Contrast, "contrast");
+    if (plan.global_threshold) {
+        apply(threshold(current, thresh), Stage::Binarize, "threshold");
+    } else {
+        apply(binarize(current), Stage::Binarize, "binarize");
+    }
+    return current;
+}
+
+std::string encode_png(Pix* image) {
+    std::string png;
+    l_uint8* png_data = nullptr;
+    size_t png_size = 0;
+    if (pixWriteMem(&png_data, &png_size, image, IFF_PNG) == 0 && png_data) {
+        png.assign(reinterpret_cast<const char*>(png_data), png_size);
+    }
+    lept_free(png_data);
+    return png;
+}
+
+bool recognize(tesseract::TessBaseAPI* api, Pix* image, std::string& text, const CancelCheck& cancelled) {
+    // Tesseract polls the monitor between words and gives up once it says so
+    tesseract::ETEXT_DESC monitor;
+    if (cancelled) {
+        monitor.cancel = [](void* check, int) { return (*static_cast<const CancelCheck*>(check))(); };
+        monitor.cancel_this = const_cast<CancelCheck*>(&cancelled);
+    }
+    
+    api->SetImage(image);
+    if (api->Recognize(cancelled ? &monitor : nullptr) != 0) {
+        return false;
+    }
+    
+    char* raw_text = api->GetUTF8Text();
+    text = raw_text ? raw_text : "";
+    delete[] raw_text;
+    normalize_text(text);
+    return true;
+}
+
+bool recognize_fallback(tesseract::TessBaseAPI* api, Pix* image, std::string& text,
+                        const CancelCheck& cancelled) {
+    const int page_confidence = api->MeanTextConf();
+    if (!text.empty() && page_confidence >= fallback_confidence) return false;
+    
+    // Words of the first pass and where its lines and blocks end
+    struct Region {
+        int x, y, w, h;
+        std::string text;
+        float confidence;
+        const char* separator;
+    };
+    std::vector<Region> regions;
+    if (tesseract::ResultIterator* it = api->GetIterator()) {
+        do {
+            if (it->Empty(tesseract::RIL_WORD)) continue;
+            int left, top, right, bottom;
+            it->BoundingBox(tesseract::RIL_WORD, &left, &top, &right, &bottom);
+            char* word = it->GetUTF8Text(tesseract::RIL_WORD);
+            const char* separator = it->IsAtFinalElement(tesseract::RIL_BLOCK, tesseract::RIL_WORD) ? "\n\n"
+                                  : it->IsAtFinalElement(tesseract::RIL_TEXTLINE, tesseract::RIL_WORD) ? "\n" : " ";
+            regions.push_back({left, top, right - left, bottom - top, word ? word : "",
+                               it->Confidence(tesseract::RIL_WORD), separator});
+            delete[] word;
+        } while (it->Next(tesseract::RIL_WORD));
+        delete it;
+    }
+    
+    // No words at all: try the text lines its layout analysis found
+    tesseract::PageSegMode mode = tesseract::PSM_SINGLE_WORD;
+    if (regions.empty()) {
+        mode = tesseract::PSM_SINGLE_LINE;
+        Boxa* lines = api->GetComponentImages(tesseract::RIL_TEXTLINE, true, nullptr, nullptr);
+        for (int i = 0; lines && i < boxaGetCount(lines); ++i) {
+            int x, y, w, h;
+            boxaGetBoxGeometry(lines, i, &x, &y, &w, &h);
+            regions.push_back({x, y, w, h, "", 0.0f, "\n"});
+        }
+        boxaDestroy(&lines);
+    }
+    
+    // The weakest words, largest first: a big misread costs the most text
+    std::vector<Region*> weak;
+    for (Region& region : regions) {
+        if (region.confidence < fallback_confidence) weak.push_back(&region);
+    }
+    auto area = [](const Region* region) { return int64_t(region->w) * region->h; };
+    if (weak.size() > fallback_max_regions) {
+        std::partial_sort(weak.begin(), weak.begin() + fallback_max_regions, weak.end(),
+            [&](const Region* a, const Region* b) {
+                return a->confidence != b->confidence ? a->confidence < b->confidence : area(a) > area(b);
+            });
+        weak.resize(fallback_max_regions);
+    }
+    std::sort(weak.begin(), weak.end(), [&](const Region* a, const Region* b) { return area(a) > area(b); });
+    
+    // Every crop replaces the page on api, so the first pass is read out above
+    bool ran = false;
+    bool changed = false;
+    for (Region* region : weak) {
+        if (cancelled && cancelled()) break;
+        ran = true;
+        Pix* crop = crop_region(image, region->x, region->y, region->w, region->h);
+        std::string piece;
+        api->SetPageSegMode(mode);
+        if (crop && recognize(api, crop, piece, cancelled) && !piece.empty() && api->MeanTextConf() > region->confidence) {
+            region->text = std::move(piece);
+            region->confidence = api->MeanTextConf();
+            changed = true;
+        }
+        pixDestroy(&crop);
+    }
+    if (!changed) return ran;
+    
+    text.clear();
+    for (const Region& region : regions) {
+        text += region.text;
+        text += region.separator;
+    }
+    normalize_text(text);
+    return true;
+}
+
+bool Whitelist::allows(char32_t c) const {
+    if (all) return true;
+    if (c < 0x80) return (ascii[c / 64] >> (c % 64)) & 1;
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), c,
+        [](char32_t value, const std::pair<char32_t, char32_t>& range) { return value < range.first; });
+    return it != ranges.begin() && c <= std::prev(it)->second;
+}
+
+bool parse_whitelist(const std::string& spec, Whitelist& whitelist) {
+    whitelist = Whitelist{};
+    whitelist.all = false;
+    // Every item must parse, the empty one of "" or "ascii," included: a
+    // whitelist that allows nothing would blank every response
+    std::string_view rest = spec;
+    for (bool more = true; more;) {
+        size_t comma = rest.find(',');
+        std::string_view item = rest.substr(0, comma);
+        more = comma != std::string_view::npos;
+        if (more) rest.remove_prefix(comma + 1);
+        
+        char32_t first, last;
+        size_t dash = item.find('-');
+        if (item == "all") {
+            whitelist.all = true;
+        } else if (item == "ascii") {
+            allow_range(whitelist, 0x21, 0x7e);
+        } else if (item == "latin1") {
+            allow_range(whitelist, 0x21, 0x7e);
+            allow_range(whitelist, 0xa1, 0xff);
+        } else if (dash != std::string_view::npos && parse_code_point(item.substr(0, dash), first) &&
+                   parse_code_point(item.substr(dash + 1), last) && first <= last) {
+            allow_range(whitelist, first, last);
+        } else if (dash == std::string_view::npos && parse_code_point(item, first)) {
+            allow_range(whitelist, first, first);
+        } else {
+            return false;
+        }
+    }
+    
+    // Merge overlapping ranges so allows() can binary search them
+    std::sort(whitelist.ranges.begin(), whitelist.ranges.end());
+    std::vector<std::pair<char32_t, char32_t>> merged;
+    for (const auto& range : whitelist.ranges) {
+        if (!merged.empty() && range.first <= merged.back().second + 1) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    whitelist.ranges = std::move(merged);
+    return true;
+}
+
+void set_whitelist(Whitelist whitelist) {
+    text_whitelist = std::move(whitelist);
+}
+
+void normalize_text(std::string& text, const Whitelist& whitelist) {
+    // Characters only ever shrink or disappear, so the output is written
+    // over the input behind the read position. Whitespace is held back
+    // until the next kept character, which drops it at both ends.
+    unsigned char* p = reinterpret_cast<unsigned char*>(text.data());
+    const size_t size = text.size();
+    size_t out = 0;
+    bool space = false;
+    int newlines = 0;
+    
+    for (size_t in = 0; in < size;) {
+        char32_t c;
+        size_t length = decode_utf8(p + in, size - in, c);
+        if (length == 0) {
+            in++;
+            continue;
+        }
+        
+        switch (classify(c)) {
+        case CharClass::Newline:
+            newlines++;
+            break;
+        case CharClass::Space:
+            space = true;
+            break;
+        case CharClass::Drop:
+            break;
+        case CharClass::Keep:
+            if (!whitelist.allows(c)) break;
+            if (out > 0 && newlines > 0) {
+                p[out++] = '\n';
+                if (newlines > 1) p[out++] = '\n';
+            } else if (out > 0 && space) {
+                p[out++] = ' ';
+            }
+            space = false;
+            newlines = 0;
+            std::memmove(p + out, p + in, length);
+            out += length;
+            break;
+        }
+        in += length;
+    }
+    text.resize(out);
+}
+
+void normalize_text(std::string& text) {
+    normalize_text(text, text_whitelist);
+}
+
+void set_split(Split split) {
+    split_mode = split;
+}
+
+// Appends one region's normalized text: lines go one per line, blocks keep
+// a blank line between them as whole-page recognition does
+void append_region(std::string& text, const std::string& piece, bool lines) {
+    if (piece.empty()) return;
+    if (!text.empty()) text += lines ? "\n" : "\n\n";
+    text += piece;
+}
+
+// Layout analysis on the whole page, then every region recognized through
+// fan_out and joined in the iterator's reading order. When on_lines is set
+// it also gets the text in reading order as soon as every region before it
+// is done. Returns false, leaving text empty, when there are fewer than
+// min_regions regions or any region failed.
+bool recognize_split(tesseract::TessBaseAPI* api, Pix* image, Split split, const FanOut& fan_out,
+                     const LinesCallback& on_lines, const CancelCheck& cancelled, int min_regions,
+                     StageTimer& timer, std::string& text) {
+    const bool lines = split == Split::Lines;
+    api->SetPageSegMode(tesseract::PSM_AUTO);
+    api->SetImage(image);
+    Boxa* boxes = api->GetComponentImages(lines ? tesseract::RIL_TEXTLINE : tesseract::RIL_BLOCK,
+                                          true, nullptr, nullptr);
+    api->Clear();
+    timer.mark(Stage::Layout);
+    
+    const int count = boxes ? boxaGetCount(boxes) : 0;
+    if (count < std::max(min_regions, 1)) {
+        boxaDestroy(&boxes);
+        return false;
+    }
+    
+    std::vector<Pix*> crops(count, nullptr);
+    for (int i = 0; i < count; ++i) {
+        int x, y, w, h;
+        Box* box = boxaGetBox(boxes, i, L_CLONE);
+        boxGetGeometry(box, &x, &y, &w, &h);
+        boxDestroy(&box);
+        crops[i] = crop_region(image, x, y, w, h);
+    }
+    boxaDestroy(&boxes);
+    
+    const tesseract::PageSegMode mode = lines ? tesseract::PSM_SINGLE_LINE : tesseract::PSM_SINGLE_BLOCK;
+    std::vector<std::string> texts(count);
+    
+    // Regions finish in any order on any thread
+    std::mutex emit_mutex;
+    std::vector<bool> done(count, false);
+    int next_emit = 0;
+    std::string emitted;
+    auto finished = [&](int i) {
+        if (!on_lines) return;
+        std::lock_guard<std::mutex> lock(emit_mutex);
+        done[i] = true;
+        size_t before = emitted.size();
+        for (; next_emit < count && done[next_emit]; ++next_emit) {
+            append_region(emitted, texts[next_emit], lines);
+        }
+        if (emitted.size() > before) on_lines(emitted.substr(before));
+    };
+    
+    std::vector<RegionJob> jobs;
+    jobs.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        // A cancelled region counts as done so its engine is not rebuilt
+        jobs.push_back([&crops, &texts, &finished, &cancelled, mode, i](tesseract::TessBaseAPI* api) {
+            if (cancelled && cancelled()) return true;
+            if (!crops[i]) return false;
+            api->SetPageSegMode(mode);
+            if (!recognize(api, crops[i], texts[i], cancelled)) return cancelled && cancelled();
+            finished(i);
+            return true;
+        });
+    }
+    bool ok = fan_out(jobs);
+    for (Pix*& crop : crops) pixDestroy(&crop);
+    if (!ok) return false;
+    
+    for (const std::string& piece : texts) {
+        append_region(text, piece, lines);
+    }
+    return true;
+}
+
+PreparedImage::PreparedImage(PreparedImage&& other) noexcept
+    : image(std::exchange(other.image, nullptr)), processed_image(std::move(other.processed_image)),
+      preprocess_path(std::move(other.preprocess_path)), error(std::move(other.error)),
+      start(other.start), timer(std::move(other.timer)) {}
+
+PreparedImage& PreparedImage::operator=(PreparedImage&& other) noexcept {
+    if (this != &other) {
+        pixDestroy(&image);
+        image = std::exchange(other.image, nullptr);
+        processed_image = std::move(other.processed_image);
+        preprocess_path = std::move(other.preprocess_path);
+        error = std::move(other.error);
+        start = other.start;
+        timer = std::move(other.timer);
+    }
+    return *this;
+}
+
+PreparedImage::~PreparedImage() {
+    pixDestroy(&image);
+}
+
+PreparedImage prepare_image(const uint8_t* data, size_t size, int page) {
+    PreparedImage prepared;
+    
+    // Decode straight from the request bytes, only the page asked for
+    Pix* image = decode(data, size, page);
+    prepared.timer.mark(Stage::Decode);
+    
+    if (!image) {
+        // Leptonica writes PDFs but cannot rasterize them
+        prepared.error = has_magic(data, size, "%PDF") ? "[ERROR: PDF input must be rasterized, e.g. to TIFF]"
+                                                        : "[ERROR: Unable to open image]";
+        return prepared;
+    }
+    
+    // Preprocessing
+    prepared.image = preprocess(image, preprocess_mode, prepared.timer, prepared.preprocess_path);
+    pixDestroy(&image);
+    
+    // Encode the processed image to PNG in memory
+    prepared.processed_image = encode_png(prepared.image);
+    prepared.timer.mark(Stage::Encode);
+    return prepared;
+}
+
+OCRResult recognize_prepared(OCREngine& engine, PreparedImage& prepared, const FanOut& fan_out,
+                             const LinesCallback& on_lines, const CancelCheck& cancelled) {
+    StageTimer& timer = prepared.timer;
+    timer.mark(Stage::Handoff);
+    
+    auto elapsed_ms = [&prepared] {
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - prepared.start).count();
+    };
+    
+    if (!prepared.image) {
+        return {prepared.error, elapsed_ms(), {}, false, timer.take(), std::move(prepared.preprocess_path)};
+    }
+    
+    tesseract::TessBaseAPI* api = engine.acquire();
+    timer.mark(Stage::Engine);
+    
+    if (!api) {
+        return {"[ERROR: Tesseract initialization failed]", elapsed_ms(), {}, false, timer.take(),
+                    std::move(prepared.preprocess_path)};
+    }
+    
+    // Perform OCR, in pieces on several engines when the page is large, and
+    // line by line when the caller wants text as it is recognized
+    std::string text;
+    bool recognized = false;
+    const Split split = split_mode;
+    const int64_t pixels = int64_t(pixGetWidth(prepared.image)) * pixGetHeight(prepared.image);
+    const bool parallel = fan_out && split != Split::Page && pixels >= split_min_pixels;
+    if (parallel || on_lines) {
+        // Without other engines the pieces run here, one after another
+        FanOut sequential = [api](std::vector<RegionJob>& jobs) {
+            for (RegionJob& job : jobs) {
+                bool ok = job(api);
+                api->Clear();
+                if (!ok) return false;
+            }
+            return true;
+        };
+        // Streaming alone does not spread a page over other engines, only
+        // --split does
+        recognized = recognize_split(api, prepared.image, parallel ? split : Split::Lines,
+                                     fan_out && split != Split::Page ? fan_out : sequential, on_lines, cancelled,
+                                     parallel ? 2 : 1, timer, text);
+        
+        // Regions may have run on this engine and re-initialized it
+        api = engine.acquire();
+        if (!api) {
+            return {"[ERROR: Tesseract initialization failed]", elapsed_ms(), {}, false, timer.take(),
+                        std::move(prepared.preprocess_path)};
+        }
+    }
+    const bool whole_page = !recognized;
+    auto stopped = [&cancelled] { return cancelled && cancelled(); };
+    if (whole_page && !stopped()) {
+        recognized = recognize(api, prepared.image, text, cancelled);
+    }
+    
+    // Stopped on purpose: the engine is fine, nobody wants the result
+    if (stopped()) {
+        engine.release();
+        return {"[ERROR: Cancelled]", elapsed_ms(), {}, false, timer.take(), std::move(prepared.preprocess_path)};
+    }
+    if (!recognized) {
+        engine.mark_bad();
+        return {"[ERROR: Recognition failed]", elapsed_ms(), std::move(prepared.processed_image), false,
+                timer.take(), std::move(prepared.preprocess_path)};
+    }
+    timer.mark(Stage::Recognize);
+    
+    // Only whole-page recognition leaves its results on api to build on, so
+    // split and streamed pages go without
+    if (whole_page && recognize_fallback(api, prepared.image, text, cancelled)) {
+        timer.mark(Stage::Fallback);
+    }
+    
+    engine.release();
+    
+    if (text.empty()) {
+        text = "[UNREADABLE]";
+    }
+    timer.mark(Stage::Cleanup);
+    
+    return {std::move(text), elapsed_ms(), std::move(prepared.processed_image), true, timer.take(),
+            std::move(prepared.preprocess_path)};
+}
+
+OCRResult process_image(OCREngine& engine, const uint8_t* data, size_t size) {
+    PreparedImage prepared = prepare_image(data, size);
+    return recognize_prepared(engine, prepared);
+}
+
+}  // namespace ocr_core
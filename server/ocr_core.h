@@ -0,0 +1,284 @@
+#pragma once
+
+#include <tesseract/baseapi.h>
+#include <leptonica/allheaders.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// OCR pipeline shared by the server and the micro-benchmarks.
+//
+// Every stage is exposed on its own so it can be measured in isolation.
+// Image stages follow Leptonica conventions: they take a borrowed Pix and
+// return a new one owned by the caller, or nullptr on failure.
+namespace ocr_core {
+
+// Pipeline stages timed per image, plus the time spent queued
+enum class Stage { QueueWait, Engine, Decode, Grayscale, Analyze, Scale, Unsharp, Contrast,
+                   Binarize, Preprocess, Encode, Handoff, Layout, Recognize, Fallback, Cleanup, Total,
+                   Count };
+
+constexpr const char* stage_names[] = {
+    "queue_wait", "engine", "decode", "grayscale", "analyze", "scale", "unsharp", "contrast",
+    "binarize", "preprocess", "encode", "handoff", "layout", "recognize", "fallback", "cleanup", "total"
+};
+
+constexpr size_t stage_count = static_cast<size_t>(Stage::Count);
+
+struct StageTime {
+    Stage stage;
+    double ms;
+};
+
+// Times consecutive pipeline stages: each mark() closes the stage that
+// began at the previous mark (or at construction)
+class StageTimer {
+private:
+    std::chrono::steady_clock::time_point last;
+    std::vector<StageTime> stages;
+    
+public:
+    StageTimer() : last(std::chrono::steady_clock::now()) {
+        stages.reserve(stage_count);
+    }
+    
+    void mark(Stage stage) {
+        auto now = std::chrono::steady_clock::now();
+        stages.push_back({stage, std::chrono::duration<double, std::milli>(now - last).count()});
+        last = now;
+    }
+    
+    std::vector<StageTime> take() { return std::move(stages); }
+};
+
+// Structure to hold both text and processed image
+struct OCRResult {
+    std::string text;
+    double time_ms;
+    std::string processed_image;  // PNG bytes, ready to move into OCRResponse
+    bool success = true;
+    std::vector<StageTime> stages;
+    std::string preprocess_path;  // Preprocessing steps taken, e.g. "grayscale,threshold"
+};
+
+// Long-lived Tesseract engine owned by a single worker thread.
+// Loading the LSTM model is far more expensive than recognizing a small
+// crop, so the engine is initialized once and only Clear()ed between jobs.
+class OCREngine {
+private:
+    std::unique_ptr<tesseract::TessBaseAPI> api;
+    bool ready;
+    size_t jobs_done;
+    
+    bool init();
+    void shutdown();
+    
+public:
+    static constexpr const char* tessdata_path = "./tessdata";
+    static constexpr const char* lang = "eng";
+    
+    OCREngine() : ready(false), jobs_done(0) {}
+    ~OCREngine() { shutdown(); }
+    
+    OCREngine(const OCREngine&) = delete;
+    OCREngine& operator=(const OCREngine&) = delete;
+    
+    // Initialize and run one recognition on a synthetic image so the model
+    // weights are paged in before the first real request arrives
+    bool warm_up();
+    
+    bool healthy() const;
+    
+    // Returns a ready engine, re-initializing it if it was marked bad
+    tesseract::TessBaseAPI* acquire();
+    
+    // Drop per-image state, keep the loaded model
+    void release();
+    
+    // Called when recognition fails; the next acquire() rebuilds the engine
+    void mark_bad();
+};
+
+// Which implementation a preprocessing stage runs. Auto uses the SIMD
+// kernels (kernels.h) where init_kernels() found them to match Leptonica
+// and Leptonica otherwise; Leptonica forces the library code.
+enum class Impl { Auto, Leptonica };
+
+// Outcome of init_kernels(): the kernel variant in use and which stages
+// run on it. A stage stays on Leptonica if its output differed.
+struct KernelReport {
+    std::string variant;
+    bool grayscale = false;
+    bool unsharp = false;
+    bool contrast = false;
+    bool binarize = false;
+};
+
+// Selects the kernel variant ("auto", "scalar", "sse4", "avx2", "avx512",
+// or "off" for Leptonica only) and compares each accelerated stage with
+// Leptonica on synthetic pages. Call once before processing images.
+KernelReport init_kernels(const std::string& variant);
+
+// Synthetic color page with lines of glyph-like strokes on noisy paper
+Pix* make_test_page(int width, int height, uint32_t seed = 12345);
+
+// Preprocessing stages
+int page_count(const uint8_t* data, size_t size);  // Directories of a TIFF, 1 otherwise
+Pix* decode(const uint8_t* data, size_t size, int page = 0);
+Pix* to_grayscale(Pix* image, Impl impl = Impl::Auto);
+Pix* scale_to_minimum(Pix* gray, int min_width = 500, int min_height = 250);  // Clone if large enough
+Pix* unsharp(Pix* gray, Impl impl = Impl::Auto);
+Pix* normalize_contrast(Pix* gray, Impl impl = Impl::Auto);
+Pix* binarize(Pix* gray, Impl impl = Impl::Auto);
+Pix* threshold(Pix* gray, int thresh, Impl impl = Impl::Auto);  // Global, no background normalization
+std::string encode_png(Pix* image);
+
+// Cheap statistics of a grayscale page, taken from at most 256 sampled rows
+struct ImageStats {
+    int threshold = 0;           // Global Otsu threshold
+    float bimodality = 0.0f;     // Between-class over total variance, 1 = two flat levels
+    float contrast = 0.0f;       // Distance between the two class means
+    float noise = 0.0f;          // Mean step between neighbours of the same class
+    float stroke_width = 0.0f;   // Mean horizontal run of the minority class, in pixels
+};
+
+ImageStats analyze(Pix* gray);
+
+// Stages the adaptive path runs for a page with the given statistics
+struct PreprocessPlan {
+    bool scale = true;
+    bool unsharp = true;
+    bool contrast = true;
+    bool global_threshold = false;  // threshold() instead of binarize()
+};
+
+PreprocessPlan plan_preprocessing(const ImageStats& stats, int width, int height);
+
+// How process_image() preprocesses. Staged runs every stage above, Fused
+// runs preprocess_fused() (staged for inputs it does not take), and
+// Adaptive (the default) runs the stages plan_preprocessing() picks.
+enum class Preprocess { Staged, Fused, Adaptive };
+
+constexpr const char* preprocess_names[] = {"staged", "fused", "adaptive"};
+
+void set_preprocess(Preprocess mode);
+
+// Preprocesses a decoded image in the given mode, timing each step and
+// listing the steps taken in path. Returns the binary image, or the last
+// step that succeeded.
+Pix* preprocess(Pix* image, Preprocess mode, StageTimer& timer, std::string& path);
+
+// Grayscale, upscaling, unsharp masking, contrast normalization and a
+// global Otsu threshold fused into two streaming passes over the image that
+// keep only a few rows in cache and allocate nothing but the 1 bpp result.
+// There is no background normalization, which needs the whole image, so
+// the output is close to but not the same as the staged chain's.
+// Returns nullptr for colormapped images or depths other than 8 and 32.
+Pix* preprocess_fused(Pix* image);
+
+// Polled while recognizing: returns true once the result is no longer
+// wanted, e.g. the client went away or its deadline passed
+using CancelCheck = std::function<bool()>;
+
+// Recognition stages; both expect api to come from OCREngine::acquire()
+// and produce normalized text. recognize() returns false when Tesseract
+// itself failed or cancelled stopped it.
+bool recognize(tesseract::TessBaseAPI* api, Pix* image, std::string& text, const CancelCheck& cancelled = {});
+// Second pass for pages recognize() was unsure of, judged by Tesseract's
+// mean word confidence. Reuses the words and layout of the first pass
+// still held by api and re-recognizes only crops of the low-confidence
+// words (or, without any words, of the text lines) on their own, keeping
+// each new reading that is more confident. At most the 16 weakest are
+// read again, largest first. Returns true if it re-recognized anything.
+bool recognize_fallback(tesseract::TessBaseAPI* api, Pix* image, std::string& text,
+                        const CancelCheck& cancelled = {});
+
+// How recognize_prepared() treats pages of a megapixel or more. Page
+// recognizes them whole on one engine. Blocks and Lines run layout
+// analysis once, cut the page at text block or line boundaries and hand
+// the pieces to a FanOut so several engines share the page; the text is
+// joined back in reading order.
+enum class Split { Page, Blocks, Lines };
+
+constexpr const char* split_names[] = {"page", "blocks", "lines"};
+
+void set_split(Split split);
+
+// One piece of a split page, recognized on whichever engine runs it.
+// Returns false when recognition failed on that engine.
+using RegionJob = std::function<bool(tesseract::TessBaseAPI* api)>;
+
+// Runs every job, each on some engine, and returns once all have
+// finished: true if they all succeeded
+using FanOut = std::function<bool(std::vector<RegionJob>& jobs)>;
+
+// Receives text as recognition progresses, in reading order: each call
+// carries only the lines recognized since the previous one
+using LinesCallback = std::function<void(const std::string& lines)>;
+
+// Characters normalize_text() keeps besides whitespace. The default keeps
+// every printable code point.
+struct Whitelist {
+    bool all = true;
+    uint64_t ascii[2] = {};                             // One bit per code point below 0x80
+    std::vector<std::pair<char32_t, char32_t>> ranges;  // Inclusive ranges above 0x7f, sorted
+    
+    bool allows(char32_t c) const;
+};
+
+// Parses a comma-separated list of "all", "ascii", "latin1" and hex code
+// points or ranges such as "U+0400-U+04FF". Returns false on bad input,
+// including an empty spec or item.
+bool parse_whitelist(const std::string& spec, Whitelist& whitelist);
+
+// Selects the whitelist recognized text is filtered with. Call once before
+// processing images.
+void set_whitelist(Whitelist whitelist);
+
+// Text post-processing, one pass in place: drops malformed UTF-8, control
+// and zero-width characters and whatever the whitelist rejects, turns tabs
+// and Unicode spaces into single spaces, keeps at most one blank line and
+// trims both ends
+void normalize_text(std::string& text, const Whitelist& whitelist);
+void normalize_text(std::string& text);  // With the set_whitelist() one
+
+// A decoded, preprocessed and encoded image waiting for recognition. Owns
+// image, which is null when decoding failed (error says why).
+struct PreparedImage {
+    Pix* image = nullptr;
+    std::string processed_image;  // PNG bytes
+    std::string preprocess_path;
+    std::string error;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    StageTimer timer;
+    
+    PreparedImage() = default;
+    PreparedImage(PreparedImage&& other) noexcept;
+    PreparedImage& operator=(PreparedImage&& other) noexcept;
+    ~PreparedImage();
+};
+
+// The two halves of the pipeline, so they can run on separate threads.
+// prepare_image() needs no engine; recognize_prepared() times the gap
+// between the two as Stage::Handoff and reports time_ms from the start
+// of prepare_image().
+PreparedImage prepare_image(const uint8_t* data, size_t size, int page = 0);
+// Without a fan_out, or when splitting does not pay off, pages are
+// recognized whole on engine. With on_lines they are recognized line by
+// line instead, so text can be passed on before the page is done; the
+// returned text stays the complete, cleaned-up result. Lines go through
+// fan_out only under Split::Blocks or Split::Lines, and pages recognized
+// in pieces, streamed or split, skip recognize_fallback(). Once cancelled
+// returns true recognition stops early and the result is an error.
+OCRResult recognize_prepared(OCREngine& engine, PreparedImage& prepared, const FanOut& fan_out = {},
+                             const LinesCallback& on_lines = {}, const CancelCheck& cancelled = {});
+
+// The full pipeline on one thread, timing every stage
+OCRResult process_image(OCREngine& engine, const uint8_t* data, size_t size);
+
+}  // namespace ocr_core
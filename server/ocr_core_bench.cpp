@@ -0,0 +1,248 @@
+#include "ocr_core.h"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+
+// Per-stage micro-benchmarks for the OCR pipeline.
+//
+// Inputs are synthetic document pages unless OCR_CORE_BENCH_IMAGE points at
+// a real scan, which is then resized to each benchmarked page size.
+// Recognition needs ./tessdata like the server and is skipped without it.
+//
+// Stages with SIMD kernels run twice, impl:0 on Leptonica and impl:1 on the
+// kernels chosen by OCR_CORE_BENCH_KERNELS (default "auto"). A stage whose
+// kernels did not match Leptonica at startup runs Leptonica both times; the
+// "kernels" context line at the top of the output says which ones are live.
+
+using namespace ocr_core;
+
+namespace {
+
+// Intermediate images of one page size, each produced by the previous stage
+struct PageInputs {
+    Pix* color = nullptr;
+    Pix* gray = nullptr;
+    Pix* sharpened = nullptr;
+    Pix* contrast = nullptr;
+    Pix* binary = nullptr;
+    std::string png;
+};
+
+PageInputs& inputs(int width, int height) {
+    static std::map<std::pair<int, int>, PageInputs> cache;
+    auto key = std::make_pair(width, height);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+    
+    PageInputs& in = cache[key];
+    if (const char* path = std::getenv("OCR_CORE_BENCH_IMAGE")) {
+        Pix* scan = pixRead(path);
+        if (scan) {
+            in.color = pixScaleToSize(scan, width, height);
+            pixDestroy(&scan);
+        }
+    }
+    if (!in.color) {
+        in.color = make_test_page(width, height);
+    }
+    
+    in.gray = to_grayscale(in.color);
+    in.sharpened = unsharp(in.gray);
+    in.contrast = normalize_contrast(in.sharpened);
+    in.binary = binarize(in.contrast);
+    in.png = encode_png(in.color);
+    return in;
+}
+
+void page_sizes(benchmark::internal::Benchmark* b) {
+    b->Args({320, 100});     // Small crop, goes through upscaling
+    b->Args({1240, 1754});   // A4 at 150 DPI
+    b->Args({2480, 3508});   // A4 at 300 DPI
+    b->Unit(benchmark::kMillisecond);
+}
+
+// Page sizes crossed with impl: 0 = Leptonica, 1 = kernels
+void page_sizes_by_impl(benchmark::internal::Benchmark* b) {
+    for (int impl : {0, 1}) {
+        b->Args({320, 100, impl});
+        b->Args({1240, 1754, impl});
+        b->Args({2480, 3508, impl});
+    }
+    b->ArgNames({"w", "h", "impl"});
+    b->Unit(benchmark::kMillisecond);
+}
+
+Impl impl_arg(const benchmark::State& state) {
+    return state.range(2) ? Impl::Auto : Impl::Leptonica;
+}
+
+void set_pixels(benchmark::State& state) {
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+
+// Runs one image stage repeatedly on a fixed input
+template <typename StageFn>
+void run_stage(benchmark::State& state, Pix* input, StageFn stage) {
+    for (auto _ : state) {
+        Pix* out = stage(input);
+        benchmark::DoNotOptimize(out);
+        pixDestroy(&out);
+    }
+    set_pixels(state);
+}
+
+}  // namespace
+
+static void BM_Decode(benchmark::State& state) {
+    PageInputs& in = inputs(state.range(0), state.range(1));
+    for (auto _ : state) {
+        Pix* out = decode(reinterpret_cast<const uint8_t*>(in.png.data()), in.png.size());
+        benchmark::DoNotOptimize(out);
+        pixDestroy(&out);
+    }
+    set_pixels(state);
+}
+BENCHMARK(BM_Decode)->Apply(page_sizes);
+
+static void BM_Grayscale(benchmark::State& state) {
+    Impl impl = impl_arg(state);
+    run_stage(state, inputs(state.range(0), state.range(1)).color,
+              [impl](Pix* color) { return to_grayscale(color, impl); });
+}
+BENCHMARK(BM_Grayscale)->Apply(page_sizes_by_impl);
+
+static void BM_Scale(benchmark::State& state) {
+    run_stage(state, inputs(state.range(0), state.range(1)).gray,
+              [](Pix* gray) { return scale_to_minimum(gray); });
+}
+BENCHMARK(BM_Scale)->Apply(page_sizes);
+
+static void BM_Unsharp(benchmark::State& state) {
+    Impl impl = impl_arg(state);
+    run_stage(state, inputs(state.range(0), state.range(1)).gray,
+              [impl](Pix* gray) { return unsharp(gray, impl); });
+}
+BENCHMARK(BM_Unsharp)->Apply(page_sizes_by_impl);
+
+static void BM_ContrastNorm(benchmark::State& state) {
+    Impl impl = impl_arg(state);
+    run_stage(state, inputs(state.range(0), state.range(1)).sharpened,
+              [impl](Pix* gray) { return normalize_contrast(gray, impl); });
+}
+BENCHMARK(BM_ContrastNorm)->Apply(page_sizes_by_impl);
+
+static void BM_Binarize(benchmark::State& state) {
+    Impl impl = impl_arg(state);
+    run_stage(state, inputs(state.range(0), state.range(1)).contrast,
+              [impl](Pix* gray) { return binarize(gray, impl); });
+}
+BENCHMARK(BM_Binarize)->Apply(page_sizes_by_impl);
+
+static void BM_Analyze(benchmark::State& state) {
+    Pix* gray = inputs(state.range(0), state.range(1)).gray;
+    for (auto _ : state) {
+        ImageStats stats = analyze(gray);
+        benchmark::DoNotOptimize(stats);
+    }
+    set_pixels(state);
+}
+BENCHMARK(BM_Analyze)->Apply(page_sizes);
+
+// Color page to the image handed to Tesseract, mode 0 = staged, 1 = fused,
+// 2 = adaptive
+static void BM_Preprocess(benchmark::State& state) {
+    Preprocess mode = Preprocess(state.range(2));
+    run_stage(state, inputs(state.range(0), state.range(1)).color, [mode](Pix* color) {
+        StageTimer timer;
+        std::string path;
+        return preprocess(color, mode, timer, path);
+    });
+}
+BENCHMARK(BM_Preprocess)
+    ->ArgsProduct({{320}, {100}, {0, 1, 2}})
+    ->ArgsProduct({{1240}, {1754}, {0, 1, 2}})
+    ->ArgsProduct({{2480}, {3508}, {0, 1, 2}})
+    ->ArgNames({"w", "h", "mode"})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_Encode(benchmark::State& state) {
+    Pix* binary = inputs(state.range(0), state.range(1)).binary;
+    for (auto _ : state) {
+        std::string png = encode_png(binary);
+        benchmark::DoNotOptimize(png.data());
+    }
+    set_pixels(state);
+}
+BENCHMARK(BM_Encode)->Apply(page_sizes);
+
+static void BM_Recognize(benchmark::State& state) {
+    static OCREngine engine;
+    static bool ready = engine.warm_up();
+    if (!ready) {
+        state.SkipWithError("Tesseract initialization failed (is ./tessdata present?)");
+        return;
+    }
+    
+    Pix* binary = inputs(state.range(0), state.range(1)).binary;
+    for (auto _ : state) {
+        tesseract::TessBaseAPI* api = engine.acquire();
+        std::string text;
+        recognize(api, binary, text);
+        benchmark::DoNotOptimize(text.data());
+        engine.release();
+    }
+    set_pixels(state);
+}
+BENCHMARK(BM_Recognize)->Apply(page_sizes);
+
+static void BM_Cleanup(benchmark::State& state) {
+    std::string raw;
+    for (int i = 0; i < state.range(0); ++i) {
+        raw += "  The quick brown fox\tjumps over the lazy dog 0123456789 \u00a0na\u00efve caf\u00e9\r\n";
+    }
+    std::string text;
+    for (auto _ : state) {
+        text = raw;
+        normalize_text(text);
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetBytesProcessed(state.iterations() * raw.size());
+}
+BENCHMARK(BM_Cleanup)->Arg(1)->Arg(40)->Arg(400);
+
+static void BM_Pipeline(benchmark::State& state) {
+    static OCREngine engine;
+    static bool ready = engine.warm_up();
+    if (!ready) {
+        state.SkipWithError("Tesseract initialization failed (is ./tessdata present?)");
+        return;
+    }
+    
+    const std::string& png = inputs(state.range(0), state.range(1)).png;
+    for (auto _ : state) {
+        OCRResult result = process_image(engine, reinterpret_cast<const uint8_t*>(png.data()), png.size());
+        benchmark::DoNotOptimize(result.text.data());
+    }
+    set_pixels(state);
+}
+BENCHMARK(BM_Pipeline)->Apply(page_sizes);
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    
+    const char* variant = std::getenv("OCR_CORE_BENCH_KERNELS");
+    KernelReport report = init_kernels(variant ? variant : "auto");
+    std::string stages;
+    for (auto [name, live] : {std::pair{"grayscale", report.grayscale}, {"unsharp", report.unsharp},
+                              {"contrast", report.contrast}, {"binarize", report.binarize}}) {
+        if (live) stages += stages.empty() ? name : std::string(",") + name;
+    }
+    benchmark::AddCustomContext("kernels", report.variant + " [" + stages + "]");
+    
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
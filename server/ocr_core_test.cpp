@@ -0,0 +1,102 @@
+#include "ocr_core.h"
+#include <gtest/gtest.h>
+#include <string>
+
+// Behavioral checks for the text post-processing in ocr_core: UTF-8
+// validation, whitespace cleanup and the character whitelist.
+
+using namespace ocr_core;
+
+namespace {
+
+std::string normalized(std::string text, const char* spec = "all") {
+    Whitelist whitelist;
+    EXPECT_TRUE(parse_whitelist(spec, whitelist)) << spec;
+    normalize_text(text, whitelist);
+    return text;
+}
+
+TEST(NormalizeText, CollapsesWhitespaceAndTrims) {
+    EXPECT_EQ(normalized("  Hello\tworld \r\n\n\n\nnext  line  "), "Hello world\n\nnext line");
+    EXPECT_EQ(normalized("one\ntwo"), "one\ntwo");
+    EXPECT_EQ(normalized("   \n\t  "), "");
+    EXPECT_EQ(normalized(""), "");
+}
+
+TEST(NormalizeText, TurnsUnicodeSpacesIntoOne) {
+    // EM SPACE, NO-BREAK SPACE, IDEOGRAPHIC SPACE; LINE SEPARATOR is a newline
+    EXPECT_EQ(normalized("a\xe2\x80\x83\xc2\xa0 b\xe3\x80\x80" "c"), "a b c");
+    EXPECT_EQ(normalized("a\xe2\x80\xa8" "b"), "a\nb");
+}
+
+TEST(NormalizeText, DropsControlAndZeroWidthCharacters) {
+    // BOM, ZERO WIDTH SPACE, DEL, a C1 control and BEL
+    EXPECT_EQ(normalized("\xef\xbb\xbfx\xe2\x80\x8by\x7f\xc2\x85z\x07"), "xyz");
+}
+
+TEST(NormalizeText, KeepsValidMultibyteSequences) {
+    const std::string text = "na\xc3\xafve \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80";
+    EXPECT_EQ(normalized(text), text);
+}
+
+TEST(NormalizeText, DropsMalformedUtf8) {
+    EXPECT_EQ(normalized("a\x80" "b"), "ab");                 // Stray continuation byte
+    EXPECT_EQ(normalized("a\xc3" "b"), "ab");                 // Lead byte without continuation
+    EXPECT_EQ(normalized("ab\xe2\x82"), "ab");                // Truncated at the end
+    EXPECT_EQ(normalized("a\xed\xa0\x80" "b"), "ab");         // UTF-16 surrogate
+    EXPECT_EQ(normalized("a\xf4\x90\x80\x80" "b"), "ab");     // Past U+10FFFF
+    EXPECT_EQ(normalized("a\xf5\x80\x80\x80" "b"), "ab");     // Invalid lead byte
+    EXPECT_EQ(normalized("a\xff" "b"), "ab");
+}
+
+TEST(NormalizeText, DropsOverlongEncodings) {
+    // "/" encoded in two, three and four bytes
+    EXPECT_EQ(normalized("a\xc0\xaf" "b"), "ab");
+    EXPECT_EQ(normalized("a\xe0\x80\xaf" "b"), "ab");
+    EXPECT_EQ(normalized("a\xf0\x80\x80\xaf" "b"), "ab");
+    // Smallest code points that do need three and four bytes
+    EXPECT_EQ(normalized("\xe0\xa0\x80"), "\xe0\xa0\x80");
+    EXPECT_EQ(normalized("\xf0\x90\x80\x80"), "\xf0\x90\x80\x80");
+}
+
+TEST(Whitelist, AsciiAndLatin1) {
+    const std::string text = "na\xc3\xafve caf\xc3\xa9 \xd0\x96";
+    EXPECT_EQ(normalized(text, "ascii"), "nave caf");
+    EXPECT_EQ(normalized(text, "latin1"), "na\xc3\xafve caf\xc3\xa9");
+    EXPECT_EQ(normalized(text, "all"), text);
+}
+
+TEST(Whitelist, CodePointsAndRanges) {
+    EXPECT_EQ(normalized("caf\xc3\xa9 \xd0\x96", "ascii,U+0400-U+04FF"), "caf \xd0\x96");
+    EXPECT_EQ(normalized("caf\xc3\xa9 \xd0\x96", "ascii,U+00E9"), "caf\xc3\xa9");
+    EXPECT_EQ(normalized("abc", "61-62"), "ab");
+}
+
+TEST(Whitelist, MergesOverlappingRanges) {
+    Whitelist whitelist;
+    ASSERT_TRUE(parse_whitelist("U+0405-U+0420,U+0400-U+0410,U+0421,U+0500", whitelist));
+    EXPECT_EQ(whitelist.ranges.size(), 2u);
+    EXPECT_TRUE(whitelist.allows(0x0400));
+    EXPECT_TRUE(whitelist.allows(0x0415));
+    EXPECT_TRUE(whitelist.allows(0x0421));
+    EXPECT_FALSE(whitelist.allows(0x0422));
+    EXPECT_FALSE(whitelist.allows(0x04ff));
+    EXPECT_TRUE(whitelist.allows(0x0500));
+    EXPECT_FALSE(whitelist.allows('a'));
+}
+
+TEST(Whitelist, RejectsBadSpecs) {
+    Whitelist whitelist;
+    EXPECT_FALSE(parse_whitelist("U+zz", whitelist));
+    EXPECT_FALSE(parse_whitelist("0-", whitelist));
+    EXPECT_FALSE(parse_whitelist("U+0410-U+0400", whitelist));  // Backwards
+    EXPECT_FALSE(parse_whitelist("U+110000", whitelist));       // Past Unicode
+    EXPECT_FALSE(parse_whitelist("ascii,,latin1", whitelist));
+    EXPECT_FALSE(parse_whitelist("", whitelist));               // Would allow nothing
+    EXPECT_FALSE(parse_whitelist(",", whitelist));
+    EXPECT_FALSE(parse_whitelist("ascii,", whitelist));
+    EXPECT_FALSE(parse_whitelist(",ascii", whitelist));
+    EXPECT_FALSE(parse_whitelist("cyrillic", whitelist));
+}
+
+}  // namespace
@@ -0,0 +1,91 @@
+#include "work_queue.h"
+#include <benchmark/benchmark.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Worker pool handoff micro-benchmarks.
+//
+// Compares the mutex and condition variable queue the pool used to hand
+// pages to recognizers with both --handoff modes it has now: LockedQueue,
+// parking at once, and the lock-free ring with the pool's spin policy.
+// Every thread pushes an item and then takes one, so all threads contend
+// on both ends; run from 1 to 128 threads. Run it on the target machine
+// before choosing --handoff=ring: the ring only wins with a core per
+// thread.
+
+namespace {
+
+// The previous handoff: a deque under one mutex, consumers sleep on a
+// condition variable
+class CondvarQueue {
+private:
+    std::deque<uint64_t> items;
+    std::mutex mutex;
+    std::condition_variable ready;
+    
+public:
+    void push(uint64_t item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(item);
+        }
+        ready.notify_one();
+    }
+    
+    uint64_t pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return !items.empty(); });
+        uint64_t item = items.front();
+        items.pop_front();
+        return item;
+    }
+};
+
+void BM_CondvarQueue(benchmark::State& state) {
+    static CondvarQueue queue;
+    uint64_t sum = 0;
+    for (auto _ : state) {
+        queue.push(state.thread_index());
+        sum += queue.pop();
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CondvarQueue)->ThreadRange(1, 128)->UseRealTime();
+
+// One push and take through a WorkQueue, the way the pool's workers do
+template <typename Queue>
+void push_and_take(benchmark::State& state, Queue& queue, EventCount& ready, SpinPolicy policy) {
+    uint64_t sum = 0;
+    for (auto _ : state) {
+        uint64_t item = state.thread_index();
+        while (!queue.try_push(std::move(item))) cpu_relax();
+        ready.notify_one();
+        take_or_park(ready, [&] { return queue.try_pop(item); }, [] { return false; }, policy);
+        sum += item;
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_LockedQueue(benchmark::State& state) {
+    static LockedQueue<uint64_t> queue(1024);
+    static EventCount ready;
+    push_and_take(state, queue, ready, {});
+}
+BENCHMARK(BM_LockedQueue)->ThreadRange(1, 128)->UseRealTime();
+
+void BM_MPMCQueue(benchmark::State& state) {
+    static MPMCQueue<uint64_t> queue(1024);
+    static EventCount ready;
+    SpinPolicy policy = SpinPolicy::for_threads(state.threads());
+    state.counters["spins"] = policy.spins;
+    push_and_take(state, queue, ready, policy);
+}
+BENCHMARK(BM_MPMCQueue)->ThreadRange(1, 128)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -1,302 +1,1398 @@
 #include <grpcpp/grpcpp.h>
 #include "ocr_service.grpc.pb.h"
-#include <tesseract/baseapi.h>
-#include <leptonica/allheaders.h>
+#include "logger.h"
+#include "histogram.h"
+#include "ocr_core.h"
+#include "work_queue.h"
+#include "fair_queue.h"
 #include <iostream>
 #include <thread>
 #include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <vector>
+#include <array>
 #include <chrono>
 #include <algorithm>
-#include <fstream>
+#include <memory>
+#include <latch>
+#include <functional>
+#include <atomic>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <cstring>
+#include <stdexcept>
 
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
+using grpc::CallbackServerContext;
 using grpc::Status;
 using ocr::OCRService;
 using ocr::ImageRequest;
 using ocr::OCRResponse;
+using ocr_core::OCREngine;
+using ocr_core::OCRResult;
+using ocr_core::Stage;
+using ocr_core::StageTime;
+using ocr_core::stage_count;
+using ocr_core::stage_names;
 
-// Structure to hold both text and processed image
-struct OCRResult {
-    std::string text;
-    double time_ms;
-    std::vector<uint8_t> processed_image;
+// Server tunables, set from --key=value command line options
+struct ServerConfig {
+    std::string address = "0.0.0.0:50051";
+    size_t num_threads = 4;                        // Recognition threads, one Tesseract engine each
+    size_t preprocess_threads = 2;
+    size_t handoff_queue = 8;                      // Preprocessed images waiting for recognition
+    std::string handoff = "locked";                // Handoff queues: "locked" or lock-free "ring"
+    ocr_core::Split split = ocr_core::Split::Page; // Large pages recognized in pieces across engines
+    size_t max_queue_tasks = 1024;                 // Admission bound by count
+    size_t max_queue_bytes = 512ull * 1024 * 1024; // Admission bound by image bytes
+    int stats_interval_s = 10;                     // 0 disables periodic stats
+    size_t cache_bytes = 256ull * 1024 * 1024;     // Result cache budget, 0 disables
+    LogLevel log_level = LogLevel::Info;
+    int64_t log_rate = 200;                        // Per-request log lines per second, 0 = unlimited
+    std::string kernels = "auto";                  // Preprocessing kernels, "off" = Leptonica only
+    ocr_core::Preprocess preprocess = ocr_core::Preprocess::Adaptive;
+    std::string whitelist = "all";                 // Characters kept in recognized text
+    std::string fair_by = "batch";                 // Fair-queuing flows: "batch", "peer" or "none"
+    std::unordered_map<std::string, double> flow_weights;  // Share of each named flow, default 1
+    int starvation_ms = 2000;                      // Lower-priority pages waiting longer get a turn
 };
 
-// Thread pool task structure
+// Shared by every page of one call: set when the client cancels or goes
+// away, and implied once the call's deadline has passed
+struct Cancellation {
+    std::atomic<bool> cancelled{false};
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    
+    bool expired() const {
+        return cancelled.load(std::memory_order_relaxed) || std::chrono::steady_clock::now() >= deadline;
+    }
+    
+    const char* reason() const {
+        return cancelled.load(std::memory_order_relaxed) ? "Cancelled by client" : "Deadline exceeded";
+    }
+};
+
+// One page of an uploaded image; the pages of a multi-page TIFF share the
+// request and are queued, processed and answered independently. request
+// may be borrowed from gRPC, so it must not be read after on_complete.
 struct OCRTask {
-    ImageRequest request;
+    std::shared_ptr<const ImageRequest> request;
+    int page;
+    int page_count;
     OCRResponse* response;
-    std::condition_variable* cv;
-    std::mutex* mtx;
-    bool* completed;
+    std::function<void()> on_complete;  // Runs on the worker once *response is filled
+    std::function<void(const std::string& lines)> on_partial;  // Set to stream text as it is recognized
+    std::shared_ptr<const Cancellation> cancellation;           // Null if the result is always wanted
+    std::string flow;                                           // Fair-queuing flow, see FairQueue
+    std::chrono::steady_clock::time_point enqueued_at;
 };
 
+// True once nobody will read the task's result
+bool abandoned(const OCRTask& task) {
+    return task.cancellation && task.cancellation->expired();
+}
+
+// Tier of ImageRequest.priority, see TieredQueue
+Tier tier_of(const OCRTask& task) {
+    switch (task.request->priority()) {
+    case ocr::INTERACTIVE: return Tier::Interactive;
+    case ocr::BULK: return Tier::Bulk;
+    default: return Tier::Normal;
+    }
+}
+
+// Share of the upload charged to one page against the queue's byte bound
+size_t task_bytes(const OCRTask& task) {
+    return task.request->image_data().size() / std::max(task.page_count, 1);
+}
+
+// Snapshot of the work queue for reporting
+struct QueueStats {
+    size_t depth;
+    size_t flows;       // Batches or clients with queued work
+    std::array<size_t, tier_count> tier_depth;
+    size_t bytes;
+    size_t peak_depth;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t abandoned;  // Skipped or stopped early because nobody waited any more
+    double avg_wait_ms;
+    double max_wait_ms;
+};
+
+// Load on one pipeline stage since the previous report, as fractions of
+// its threads' wall time
+struct StageUtilization {
+    const char* stage;
+    size_t threads;
+    double busy;     // Working on an image
+    double blocked;  // Holding a finished image while the next queue is full
+};
+
+// Two-stage worker pool. Preprocessing threads take admitted tasks, decode
+// and preprocess them and hand the results through a bounded queue to the
+// recognition threads, each of which owns a Tesseract engine. The stages
+// are sized separately and image N + 1 is preprocessed while image N is
+// being recognized; a full handoff queue stalls preprocessing, which in
+// turn backs up the admission queue.
+//
+// Admission stays under queue_mutex: deficit round robin, tier rescue and
+// the byte bound all decide on the state of every flow at once, which a
+// lock-free queue cannot give. Each page takes it once on the way in and
+// once on the way out, and only preprocessors wait on it; recognizers
+// never touch it. The handoff and region queues behind it are WorkQueues:
+// locked by default, or lock-free rings whose idle threads spin briefly
+// before parking while every thread has a core.
 class ThreadPool {
 private:
-    std::vector<std::thread> workers;
-    std::queue<OCRTask> tasks;
+    // Busy and blocked time of one stage's threads, in nanoseconds
+    struct StageLoad {
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> blocked_ns{0};
+        uint64_t reported_busy_ns = 0;     // Totals at the previous utilization() call
+        uint64_t reported_blocked_ns = 0;
+    };
+    
+    // A preprocessed image waiting for a recognition thread
+    struct PreparedTask {
+        OCRTask task;
+        double wait_ms;
+        ocr_core::PreparedImage image;
+    };
+    
+    std::vector<std::thread> preprocessors;
+    std::vector<std::thread> recognizers;
+    TieredQueue<OCRTask> tasks;
     std::mutex queue_mutex;
     std::condition_variable condition;
+    size_t idle_preprocessors;  // Waiting on condition, so try_enqueue only notifies when one is
     bool stop;
     
-    OCRResult process_image(const std::vector<uint8_t>& image_data) {
-        auto start = std::chrono::high_resolution_clock::now();
-        
-        // Write image data to temporary file
-        std::string temp_filename = "ocr_temp_" + 
-            std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".png";
-        std::ofstream temp_file(temp_filename, std::ios::binary);
-        temp_file.write(reinterpret_cast<const char*>(image_data.data()), image_data.size());
-        temp_file.close();
-        
-        tesseract::TessBaseAPI api;
-        const std::string lang = "eng";
-        const char* tessdata_path = "./tessdata";
-        
-        if (api.Init(tessdata_path, lang.c_str(), tesseract::OEM_LSTM_ONLY)) {
-            std::remove(temp_filename.c_str());
-            auto end = std::chrono::high_resolution_clock::now();
-            double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
-            return {"[ERROR: Tesseract initialization failed]", elapsed, {}};
-        }
-        
-        api.SetPageSegMode(tesseract::PSM_SINGLE_BLOCK);
-        
-        Pix* image = pixRead(temp_filename.c_str());
-        std::remove(temp_filename.c_str());
-        
-        if (!image) {
-            api.End();
-            auto end = std::chrono::high_resolution_clock::now();
-            double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
-            return {"[ERROR: Unable to open image]", elapsed, {}};
-        }
-        
-        // Preprocessing
-        Pix* gray = pixConvertTo8(image, false);
-        pixDestroy(&image);
-        
-        int w = pixGetWidth(gray);
-        int h = pixGetHeight(gray);
-        
-        Pix* scaled = gray;
-        if (w < 500 || h < 250) {
-            float scale = std::max(500.0f / w, 250.0f / h);
-            scaled = pixScale(gray, scale, scale);
-            pixDestroy(&gray);
-        }
-        
-        Pix* sharpened = pixUnsharpMaskingGray(scaled, 5, 2.5);
-        if (sharpened) {
-            pixDestroy(&scaled);
-            scaled = sharpened;
-        }
-        
-        Pix* contrast = pixContrastNorm(NULL, scaled, 50, 50, 130, 2, 2);
-        if (contrast) {
-            pixDestroy(&scaled);
-            scaled = contrast;
-        }
+    // The pieces of a split page not yet finished. Shared with the queued
+    // work so a recognizer can still signal it after the owner has returned.
+    struct RegionBatch {
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
         
-        Pix* binary = pixOtsuThreshOnBackgroundNorm(scaled, NULL, 10, 10, 100, 50, 10, 10, 10, 0.1, NULL);
-        Pix* final_image = binary ? binary : scaled;
-        
-        // Save the processed image to memory
-        std::string processed_filename = "processed_" + 
-            std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".png";
-        pixWrite(processed_filename.c_str(), final_image, IFF_PNG);
-        
-        // Read processed image into vector
-        std::ifstream proc_file(processed_filename, std::ios::binary);
-        std::vector<uint8_t> processed_data(
-            (std::istreambuf_iterator<char>(proc_file)),
-            std::istreambuf_iterator<char>());
-        proc_file.close();
-        std::remove(processed_filename.c_str());
-        
-        // Perform OCR
-        api.SetImage(final_image);
-        char* raw_text = api.GetUTF8Text();
-        std::string text = raw_text ? raw_text : "";
-        
-        text.erase(std::remove_if(text.begin(), text.end(), 
-            [](unsigned char c) { return c > 127 || (c < 32 && c != ' ' && c != '\n'); }), text.end());
-        
-        if (text.empty() || text.length() < 2) {
-            api.SetPageSegMode(tesseract::PSM_SINGLE_WORD);
-            api.SetImage(final_image);
-            delete[] raw_text;
-            raw_text = api.GetUTF8Text();
-            text = raw_text ? raw_text : "";
-            
-            text.erase(std::remove_if(text.begin(), text.end(), 
-                [](unsigned char c) { return c > 127 || (c < 32 && c != ' ' && c != '\n'); }), text.end());
-        }
-        
-        delete[] raw_text;
-        if (binary) pixDestroy(&binary);
-        pixDestroy(&scaled);
-        api.End();
-        
-        // Clean up text
-        text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
-        text.erase(std::remove(text.begin(), text.end(), '\t'), text.end());
-        
-        size_t start_pos = text.find_first_not_of(" \n");
-        size_t end_pos = text.find_last_not_of(" \n");
-        if (start_pos != std::string::npos && end_pos != std::string::npos) {
-            text = text.substr(start_pos, end_pos - start_pos + 1);
-        } else {
-            text = "";
-        }
-        
-        if (text.empty()) {
-            text = "[UNREADABLE]";
-        }
-        
-        auto end = std::chrono::high_resolution_clock::now();
-        double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
-        
-        return {text, elapsed, processed_data};
+        explicit RegionBatch(size_t count) : remaining(count) {}
+    };
+    
+    struct RegionWork {
+        ocr_core::RegionJob* job = nullptr;
+        std::shared_ptr<RegionBatch> batch;
+    };
+    
+    static constexpr size_t region_capacity = 1024;  // Beyond this a page runs its own regions
+    
+    // Handoff between the stages, one ring per tier so higher tiers overtake
+    // lower ones still waiting for a recognizer. prepared_count bounds them
+    // together and is only raised by reserve_handoff(), so no ring can fill.
+    // Idle recognizers take region work, which belongs to pages already
+    // being recognized, before new pages.
+    std::array<std::unique_ptr<WorkQueue<PreparedTask>>, tier_count> prepared;
+    std::unique_ptr<WorkQueue<RegionWork>> regions;
+    std::atomic<size_t> prepared_count;
+    size_t max_prepared;
+    EventCount handoff_ready;
+    EventCount handoff_space;
+    std::atomic<bool> handoff_closed;  // Set once the preprocessors have exited
+    bool lock_free;
+    SpinPolicy idle_policy;
+    
+    // Admission control, guarded by queue_mutex
+    size_t max_tasks;
+    size_t max_bytes;
+    size_t queued_bytes;
+    size_t peak_depth;
+    uint64_t accepted;
+    uint64_t rejected;
+    double avg_wait_ms;     // EWMA of time spent queued
+    double max_wait_ms;     // Since the last stats() call
+    
+    std::atomic<double> avg_service_ms{0};  // EWMA of processing time, updated by the recognizers
+    
+    static constexpr double ewma_alpha = 0.1;
+    
+    std::array<LatencyHistogram, stage_count> stage_histograms;
+    std::array<LatencyHistogram, tier_count> tier_histograms;  // Queue wait plus processing
+    std::atomic<uint64_t> abandoned_tasks{0};
+    
+    StageLoad preprocess_load;
+    StageLoad recognize_load;
+    std::mutex utilization_mutex;
+    std::chrono::steady_clock::time_point reported_at;
+    
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - since).count();
+    }
+    
+    // Answers a task with an error instead of a result
+    static void fail(OCRTask& task, const std::string& message) {
+        task.response->set_image_id(task.request->image_id());
+        task.response->set_filename(task.request->filename());
+        task.response->set_page(task.page);
+        task.response->set_page_count(task.page_count);
+        task.response->set_success(false);
+        task.response->set_error_message(message);
+        task.on_complete();
+    }
+    
+    // Answers a task whose caller is gone without doing the work
+    void drop(OCRTask& task) {
+        abandoned_tasks++;
+        logger().request(LogLevel::Debug, "image_dropped", {
+            {"file", task.request->filename()}, {"page", task.page}, {"reason", task.cancellation->reason()}});
+        fail(task, task.cancellation->reason());
     }
     
-    void worker() {
+    void preprocessor() {
         while (true) {
             OCRTask task;
+            double wait_ms;
             {
                 std::unique_lock<std::mutex> lock(queue_mutex);
+                idle_preprocessors++;
                 condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                idle_preprocessors--;
                 
                 if (stop && tasks.empty()) return;
                 
-                task = std::move(tasks.front());
-                tasks.pop();
+                task = tasks.pop();
+                
+                queued_bytes -= task_bytes(task);
+                wait_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - task.enqueued_at).count();
+                avg_wait_ms += ewma_alpha * (wait_ms - avg_wait_ms);
+                max_wait_ms = std::max(max_wait_ms, wait_ms);
             }
             
-            // Process the image
-            std::cout << "[Worker " << std::this_thread::get_id() << "] Processing: " 
-                      << task.request.filename() << std::endl;
+            // Expired while queued: skip it rather than spend a worker on it
+            if (abandoned(task)) {
+                drop(task);
+                continue;
+            }
             
-            std::vector<uint8_t> image_data(task.request.image_data().begin(), 
-                                           task.request.image_data().end());
-            auto result = process_image(image_data);
+            logger().request(LogLevel::Debug, "image_start", {
+                {"file", task.request->filename()}, {"page", task.page}});
+            
+            // Leptonica decodes straight from the request's bytes
+            auto started = std::chrono::steady_clock::now();
+            const std::string& data = task.request->image_data();
+            ocr_core::PreparedImage image = ocr_core::prepare_image(
+                reinterpret_cast<const uint8_t*>(data.data()), data.size(), task.page);
+            preprocess_load.busy_ns += elapsed_ns(started);
+            
+            auto finished = std::chrono::steady_clock::now();
+            take_or_park(handoff_space, [this] { return reserve_handoff(); }, [] { return false; }, idle_policy);
+            size_t tier = size_t(tier_of(task));
+            PreparedTask item{std::move(task), wait_ms, std::move(image)};
+            bool pushed = prepared[tier]->try_push(std::move(item));
+            preprocess_load.blocked_ns += elapsed_ns(finished);
+            if (!pushed) {
+                // reserve_handoff() keeps every ring below its capacity, so
+                // this is a bug; answer the page rather than lose its caller
+                prepared_count.fetch_sub(1);
+                handoff_space.notify_one();
+                logger().log(LogLevel::Error, "handoff_full", {{"tier", tier_names[tier]}});
+                fail(item.task, "[ERROR: Internal handoff queue full]");
+                continue;
+            }
+            handoff_ready.notify_one();
+        }
+    }
+    
+    // Claims room for one prepared page, false while the handoff is full
+    bool reserve_handoff() {
+        size_t count = prepared_count.load(std::memory_order_relaxed);
+        while (count < max_prepared) {
+            if (prepared_count.compare_exchange_weak(count, count + 1)) return true;
+        }
+        return false;
+    }
+    
+    void recognizer(std::latch& warmed_up) {
+        OCREngine engine;
+        if (!engine.warm_up()) {
+            logger().log(LogLevel::Warn, "engine_warmup_failed");
+        }
+        warmed_up.count_down();
+        
+        while (true) {
+            RegionWork work;
+            PreparedTask item;
+            bool is_region = false;
+            auto take = [&] {
+                if (regions->try_pop(work)) {
+                    is_region = true;
+                    return true;
+                }
+                for (auto& tier : prepared) {
+                    if (tier->try_pop(item)) return true;
+                }
+                return false;
+            };
+            if (!take_or_park(handoff_ready, take, [this] { return handoff_closed.load(); }, idle_policy)) return;
+            
+            if (is_region) {
+                auto started = std::chrono::steady_clock::now();
+                run_region(work, engine);
+                recognize_load.busy_ns += elapsed_ns(started);
+                continue;
+            }
+            prepared_count.fetch_sub(1);
+            handoff_space.notify_one();
+            
+            OCRTask& task = item.task;
+            if (abandoned(task)) {
+                drop(task);
+                continue;
+            }
+            
+            // Tesseract polls this between words, so a running page stops
+            // soon after its caller goes away
+            ocr_core::CancelCheck cancelled;
+            if (task.cancellation) {
+                cancelled = [&task] { return abandoned(task); };
+            }
+            
+            auto started = std::chrono::steady_clock::now();
+            OCRResult result = ocr_core::recognize_prepared(engine, item.image, 
+                [this, &engine](std::vector<ocr_core::RegionJob>& jobs) { return fan_out(engine, jobs); },
+                task.on_partial, cancelled);
+            if (!result.success && abandoned(task)) abandoned_tasks++;
+            
+            double service = avg_service_ms.load(std::memory_order_relaxed);
+            while (!avg_service_ms.compare_exchange_weak(service, service + ewma_alpha * (result.time_ms - service),
+                                                         std::memory_order_relaxed)) {}
+            
+            tier_histograms[size_t(tier_of(task))].record_ms(item.wait_ms + result.time_ms);
+            stage_histograms[size_t(Stage::QueueWait)].record_ms(item.wait_ms);
+            stage_histograms[size_t(Stage::Total)].record_ms(result.time_ms);
+            for (const StageTime& st : result.stages) {
+                stage_histograms[size_t(st.stage)].record_ms(st.ms);
+            }
             
             // Fill response
-            task.response->set_image_id(task.request.image_id());
-            task.response->set_filename(task.request.filename());
+            task.response->set_image_id(task.request->image_id());
+            task.response->set_filename(task.request->filename());
+            task.response->set_page(task.page);
+            task.response->set_page_count(task.page_count);
             task.response->set_extracted_text(result.text);
             task.response->set_processing_time_ms(result.time_ms);
-            task.response->set_success(true);
-            task.response->set_processed_image(result.processed_image.data(), result.processed_image.size());
+            task.response->set_success(result.success);
+            if (!result.success) task.response->set_error_message(result.text);
+            task.response->set_processed_image(std::move(result.processed_image));
+            task.response->set_queue_wait_ms(item.wait_ms);
+            task.response->set_preprocess_path(result.preprocess_path);
+            for (const StageTime& st : result.stages) {
+                ocr::StageTiming* timing = task.response->add_stage_timings();
+                timing->set_stage(stage_names[size_t(st.stage)]);
+                timing->set_ms(st.ms);
+            }
             
-            std::cout << "[Worker " << std::this_thread::get_id() << "] Completed: " 
-                      << task.request.filename() << " - \"" << result.text << "\"" << std::endl;
+            // Only the size of the recognized text, never its contents; on
+            // failure the text is the error message
+            logger().request(LogLevel::Info, "image_done", {
+                {"file", task.request->filename()},
+                {"page", task.page},
+                {"ms", result.time_ms},
+                {"ok", result.success},
+                {"chars", result.text.size()},
+                {"path", result.preprocess_path},
+                {"error", result.success ? std::string_view() : std::string_view(result.text)}});
             
-            // Notify completion
-            {
-                std::lock_guard<std::mutex> lock(*task.mtx);
-                *task.completed = true;
+            recognize_load.busy_ns += elapsed_ns(started);
+            
+            // Hand the response back to the RPC
+            task.on_complete();
+        }
+    }
+    
+    void run_region(const RegionWork& work, OCREngine& engine) {
+        tesseract::TessBaseAPI* api = engine.acquire();
+        bool ok = api && (*work.job)(api);
+        if (ok) engine.release();
+        else if (api) engine.mark_bad();
+        
+        if (!ok) work.batch->failed.store(true);
+        if (work.batch->remaining.fetch_sub(1) == 1) work.batch->remaining.notify_all();
+    }
+    
+    // Spreads one page's regions over the idle recognizers. The calling
+    // recognizer works through the queue too, so the page finishes even
+    // when every other recognizer is busy.
+    bool fan_out(OCREngine& engine, std::vector<ocr_core::RegionJob>& jobs) {
+        auto batch = std::make_shared<RegionBatch>(jobs.size());
+        for (ocr_core::RegionJob& job : jobs) {
+            RegionWork work{&job, batch};
+            if (!regions->try_push(std::move(work))) run_region(work, engine);
+        }
+        handoff_ready.notify_all();
+        
+        RegionWork work;
+        while (size_t left = batch->remaining.load()) {
+            if (regions->try_pop(work)) {
+                run_region(work, engine);
+            } else {
+                batch->remaining.wait(left);
             }
-            task.cv->notify_one();
         }
+        return !batch->failed.load();
+    }
+    
+    template <typename T>
+    std::unique_ptr<WorkQueue<T>> make_queue(size_t capacity) const {
+        if (lock_free) return std::make_unique<MPMCQueue<T>>(capacity);
+        return std::make_unique<LockedQueue<T>>(capacity);
+    }
+    
+    StageUtilization utilization_of(const char* stage, StageLoad& load, size_t threads, uint64_t interval_ns) {
+        uint64_t busy = load.busy_ns.load();
+        uint64_t blocked = load.blocked_ns.load();
+        double capacity = double(interval_ns) * std::max<size_t>(threads, 1);
+        StageUtilization u{stage, threads, double(busy - load.reported_busy_ns) / capacity,
+                           double(blocked - load.reported_blocked_ns) / capacity};
+        load.reported_busy_ns = busy;
+        load.reported_blocked_ns = blocked;
+        return u;
     }
     
 public:
-    ThreadPool(size_t num_threads) : stop(false) {
-        for (size_t i = 0; i < num_threads; ++i) {
-            workers.emplace_back([this] { worker(); });
+    ThreadPool(size_t preprocess_threads, size_t recognize_threads, size_t max_tasks, size_t max_bytes,
+               size_t max_prepared, bool lock_free_handoff,
+               const std::unordered_map<std::string, double>& flow_weights, std::chrono::milliseconds starvation)
+        : tasks(flow_weights, starvation), idle_preprocessors(0), stop(false),
+          prepared_count(0), max_prepared(std::max<size_t>(max_prepared, 1)), handoff_closed(false),
+          lock_free(lock_free_handoff),
+          max_tasks(max_tasks), max_bytes(max_bytes), queued_bytes(0), peak_depth(0), accepted(0),
+          rejected(0), avg_wait_ms(0), max_wait_ms(0),
+          reported_at(std::chrono::steady_clock::now()) {
+        for (auto& tier : prepared) {
+            tier = make_queue<PreparedTask>(this->max_prepared);
+        }
+        regions = make_queue<RegionWork>(region_capacity);
+        // Locked queues park at once, as their condition variables did
+        if (lock_free) idle_policy = SpinPolicy::for_threads(preprocess_threads + recognize_threads);
+        // Block until every recognition thread has loaded its engine
+        std::latch warmed_up(recognize_threads);
+        for (size_t i = 0; i < recognize_threads; ++i) {
+            recognizers.emplace_back([this, &warmed_up] { recognizer(warmed_up); });
         }
-        std::cout << "[ThreadPool] Started with " << num_threads << " worker threads" << std::endl;
+        warmed_up.wait();
+        for (size_t i = 0; i < std::max<size_t>(preprocess_threads, 1); ++i) {
+            preprocessors.emplace_back([this] { preprocessor(); });
+        }
+        logger().log(LogLevel::Info, "pool_started", {
+            {"preprocess_threads", preprocessors.size()}, {"recognize_threads", recognize_threads},
+            {"handoff_queue", this->max_prepared}, {"handoff", lock_free ? "ring" : "locked"},
+            {"spins", idle_policy.spins}});
     }
     
     ~ThreadPool() {
+        // Drain front to back: the preprocessors finish the admitted tasks,
+        // then the recognizers finish what was handed off
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
             stop = true;
         }
         condition.notify_all();
-        for (std::thread& worker : workers) {
+        for (std::thread& worker : preprocessors) {
+            worker.join();
+        }
+        handoff_closed = true;
+        handoff_ready.notify_all();
+        for (std::thread& worker : recognizers) {
             worker.join();
         }
     }
     
-    void enqueue(OCRTask task) {
+    // Queues the task unless it would exceed the count or byte bound.
+    // Returns false without taking the task when the server is saturated.
+    bool try_enqueue(OCRTask& task) {
+        size_t bytes = task_bytes(task);
+        bool wake;
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
+            // An oversized image is still admitted into an empty queue
+            bool full = tasks.size() >= max_tasks || 
+                        (!tasks.empty() && queued_bytes + bytes > max_bytes);
+            if (full) {
+                rejected++;
+                return false;
+            }
+            task.enqueued_at = std::chrono::steady_clock::now();
             tasks.push(std::move(task));
+            queued_bytes += bytes;
+            peak_depth = std::max(peak_depth, tasks.size());
+            accepted++;
+            wake = idle_preprocessors > 0;
         }
-        condition.notify_one();
+        if (wake) condition.notify_one();
+        return true;
     }
+    
+    // Rough time until a slot frees up: queued work spread over the workers
+    int retry_after_ms() {
+        double service = avg_service_ms.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        double per_task = service > 0 ? service : 100.0;
+        double estimate = per_task * (1.0 + double(tasks.size()) / std::max<size_t>(recognizers.size(), 1));
+        return static_cast<int>(std::min(estimate, 60000.0));
+    }
+    
+    // Per-stage latency distribution since the previous call
+    std::array<LatencyHistogram::Snapshot, stage_count> stage_latency() {
+        std::array<LatencyHistogram::Snapshot, stage_count> snapshots;
+        for (size_t i = 0; i < stage_count; ++i) {
+            snapshots[i] = stage_histograms[i].snapshot(true);
+        }
+        return snapshots;
+    }
+    
+    // Per-tier end-to-end latency since the previous call
+    std::array<LatencyHistogram::Snapshot, tier_count> tier_latency() {
+        std::array<LatencyHistogram::Snapshot, tier_count> snapshots;
+        for (size_t i = 0; i < tier_count; ++i) {
+            snapshots[i] = tier_histograms[i].snapshot(true);
+        }
+        return snapshots;
+    }
+    
+    QueueStats stats() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        std::array<size_t, tier_count> tier_depth;
+        for (size_t i = 0; i < tier_count; ++i) {
+            tier_depth[i] = tasks.depth(Tier(i));
+        }
+        QueueStats snapshot{tasks.size(), tasks.flow_count(), tier_depth, queued_bytes, peak_depth, accepted, 
+                            rejected, abandoned_tasks.load(), avg_wait_ms, max_wait_ms};
+        max_wait_ms = 0;
+        return snapshot;
+    }
+    
+    size_t handoff_depth() {
+        return prepared_count.load();
+    }
+    
+    // Busy and blocked share of each stage since the previous call
+    std::array<StageUtilization, 2> utilization() {
+        std::lock_guard<std::mutex> lock(utilization_mutex);
+        uint64_t interval_ns = std::max<uint64_t>(elapsed_ns(reported_at), 1);
+        reported_at = std::chrono::steady_clock::now();
+        return {utilization_of("preprocess", preprocess_load, preprocessors.size(), interval_ns),
+                utilization_of("recognize", recognize_load, recognizers.size(), interval_ns)};
+    }
+};
+
+// Identity of an image's bytes. Two independent 64-bit hashes plus the
+// length make accidental collisions practically impossible.
+struct ContentKey {
+    uint64_t h1;
+    uint64_t h2;
+    size_t size;
+    int page = 0;
+    bool streamed = false;  // Recognized line by line for stream_partial, see task_key()
+    
+    bool operator==(const ContentKey&) const = default;
 };
 
-class OCRServiceImpl final : public OCRService::Service {
+struct ContentKeyHash {
+    size_t operator()(const ContentKey& key) const {
+        return key.h1 ^ ((key.h2 + key.page * 2 + key.streamed) * 0x9e3779b97f4a7c15ull);
+    }
+};
+
+ContentKey content_key(std::string_view data) {
+    // Word-at-a-time FNV-1a as the second, independent hash
+    uint64_t fnv = 1469598103934665603ull;
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        fnv = (fnv ^ word) * 1099511628211ull;
+    }
+    for (; i < data.size(); ++i) {
+        fnv = (fnv ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    }
+    return {std::hash<std::string_view>{}(data), fnv, data.size()};
+}
+
+struct CacheStats {
+    size_t entries;
+    size_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// LRU cache of finished responses keyed by image content, bounded by bytes.
+// Entries are shared and immutable so a hit is copied outside the lock.
+class ResultCache {
 private:
-    ThreadPool thread_pool;
+    struct Entry {
+        ContentKey key;
+        std::shared_ptr<const OCRResponse> response;
+        size_t bytes;
+    };
+    
+    std::mutex mtx;
+    std::list<Entry> lru;  // Most recently used first
+    std::unordered_map<ContentKey, std::list<Entry>::iterator, ContentKeyHash> index;
+    size_t budget;
+    size_t used;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
     
 public:
-    OCRServiceImpl(size_t num_threads) : thread_pool(num_threads) {}
+    ResultCache(size_t budget) 
+        : budget(budget), used(0), hits(0), misses(0), evictions(0) {}
+    
+    bool enabled() const { return budget > 0; }
+    
+    std::shared_ptr<const OCRResponse> lookup(const ContentKey& key) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        hits++;
+        return it->second->response;
+    }
     
-    Status ProcessImage(ServerContext* context, const ImageRequest* request,
-                       grpc::ServerWriter<OCRResponse>* writer) override {
-        std::cout << "\n[Server] Received image: " << request->filename() 
-                  << " (Batch: " << request->batch_id() << ", ID: " << request->image_id() << ")" << std::endl;
+    void insert(const ContentKey& key, const OCRResponse& response) {
+        auto stored = std::make_shared<OCRResponse>(response);
+        stored->clear_image_id();
+        stored->clear_filename();
+        stored->clear_queue_wait_ms();
+        stored->clear_stage_timings();
+        size_t bytes = stored->ByteSizeLong() + sizeof(Entry) + sizeof(OCRResponse);
+        if (bytes > budget) return;
         
-        OCRResponse response;
-        std::mutex mtx;
-        std::condition_variable cv;
-        bool completed = false;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (index.count(key)) return;
         
-        OCRTask task{*request, &response, &cv, &mtx, &completed};
-        thread_pool.enqueue(task);
+        while (used + bytes > budget && !lru.empty()) {
+            used -= lru.back().bytes;
+            index.erase(lru.back().key);
+            lru.pop_back();
+            evictions++;
+        }
+        lru.push_front({key, std::move(stored), bytes});
+        index[key] = lru.begin();
+        used += bytes;
+    }
+    
+    CacheStats stats() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return {lru.size(), used, hits, misses, evictions};
+    }
+};
+
+// Message used when admission control turns an image away
+std::string overload_message(int retry_after_ms) {
+    return "Server overloaded, retry after " + std::to_string(retry_after_ms) + " ms";
+}
+
+// Front door for OCR work: answers repeated images from the cache, folds
+// identical in-flight requests into one computation and queues the rest.
+class OCRDispatcher {
+private:
+    // A request waiting on an identical one that is already queued or running
+    struct Follower {
+        std::shared_ptr<const ImageRequest> request;
+        int page_count;
+        OCRResponse* response;
+        std::function<void()> on_complete;
+        std::function<void(const std::string& lines)> on_partial;
+        std::shared_ptr<const Cancellation> cancellation;
+        std::string flow;
+    };
+    
+    // A queued or running task and the requests waiting on it
+    struct Inflight {
+        std::vector<Follower> followers;
+        std::string streamed;  // Partial text sent so far, replayed to late followers
+    };
+    
+    ResultCache cache;  // Declared first: workers insert until the pool is joined
+    
+    std::mutex inflight_mutex;
+    std::unordered_map<ContentKey, Inflight, ContentKeyHash> inflight;
+    uint64_t coalesced;
+    
+    ThreadPool pool;
+    std::string fair_by;
+    
+    // Everything that determines the result of a task must be part of its
+    // key. A streamed page is recognized line by line and skips the
+    // fallback pass, so its text can differ from the whole-page result.
+    static ContentKey task_key(ContentKey document, const OCRTask& task) {
+        document.page = task.page;
+        document.streamed = task.request->stream_partial();
+        return document;
+    }
+    
+    // Runs on the worker as the leader streams lines, so followers of a
+    // streaming leader see them too
+    void forward_partial(const ContentKey& key, const std::string& lines) {
+        std::lock_guard<std::mutex> lock(inflight_mutex);
+        Inflight& entry = inflight.at(key);
+        entry.streamed += lines;
+        for (Follower& f : entry.followers) {
+            if (f.on_partial) f.on_partial(lines);
+        }
+    }
+    
+    // Runs on the worker after the leader's response has been filled.
+    // When the leader was abandoned its followers, which belong to other
+    // calls, are submitted again instead of inheriting the cancellation.
+    void finish_leader(const ContentKey& key, const OCRResponse& result, bool leader_abandoned) {
+        if (result.success()) cache.insert(key, result);
         
-        // Wait for completion
+        std::vector<Follower> followers;
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [&completed] { return completed; });
+            std::lock_guard<std::mutex> lock(inflight_mutex);
+            auto it = inflight.find(key);
+            followers = std::move(it->second.followers);
+            inflight.erase(it);
         }
         
-        // Send response back to client
-        writer->Write(response);
+        for (Follower& f : followers) {
+            if (leader_abandoned && !(f.cancellation && f.cancellation->expired())) {
+                resubmit(f, key);
+                continue;
+            }
+            f.response->CopyFrom(result);
+            f.response->set_image_id(f.request->image_id());
+            f.response->set_filename(f.request->filename());
+            f.on_complete();
+        }
+    }
+    
+    void resubmit(Follower& f, const ContentKey& key) {
+        OCRTask task{f.request, key.page, f.page_count, f.response, std::move(f.on_complete),
+                     std::move(f.on_partial), f.cancellation, std::move(f.flow), {}};
+        Outcome outcome = submit(task, key);
+        if (outcome == Outcome::Queued) return;
+        if (outcome == Outcome::Rejected) {
+            int retry_after = retry_after_ms();
+            f.response->set_image_id(f.request->image_id());
+            f.response->set_filename(f.request->filename());
+            f.response->set_page(key.page);
+            f.response->set_page_count(f.page_count);
+            f.response->set_success(false);
+            f.response->set_error_message(overload_message(retry_after));
+            f.response->set_retry_after_ms(retry_after);
+        }
+        task.on_complete();
+    }
+    
+public:
+    enum class Outcome { Queued, Cached, Rejected };
+    
+    OCRDispatcher(const ServerConfig& config)
+        : cache(config.cache_bytes), coalesced(0),
+          pool(config.preprocess_threads, config.num_threads, config.max_queue_tasks,
+               config.max_queue_bytes, config.handoff_queue, config.handoff == "ring", config.flow_weights,
+               std::chrono::milliseconds(config.starvation_ms)),
+          fair_by(config.fair_by) {}
+    
+    // On Cached the response is filled before returning and on_complete is
+    // not called. On Rejected the task is left with the caller. On Queued
+    // on_complete runs once the response is filled, possibly from the
+    // result of an identical request. document is document_key() of the
+    // task's request, hashed once for all of its pages.
+    Outcome submit(OCRTask& task, const ContentKey& document) {
+        auto start = std::chrono::high_resolution_clock::now();
+        ContentKey key = task_key(document, task);
+        
+        if (cache.enabled()) {
+            if (auto hit = cache.lookup(key)) {
+                task.response->CopyFrom(*hit);
+                task.response->set_image_id(task.request->image_id());
+                task.response->set_filename(task.request->filename());
+                task.response->set_cache_hit(true);
+                auto end = std::chrono::high_resolution_clock::now();
+                task.response->set_processing_time_ms(
+                    std::chrono::duration<double, std::milli>(end - start).count());
+                return Outcome::Cached;
+            }
+        }
         
-        std::cout << "[Server] Sent response for: " << request->filename() << std::endl;
+        std::lock_guard<std::mutex> lock(inflight_mutex);
         
-        return Status::OK;
+        auto it = inflight.find(key);
+        if (it != inflight.end()) {
+            // Catch up on the lines the leader has streamed already
+            if (task.on_partial && !it->second.streamed.empty()) task.on_partial(it->second.streamed);
+            it->second.followers.push_back({task.request, task.page_count, task.response,
+                                            std::move(task.on_complete), std::move(task.on_partial),
+                                            task.cancellation, task.flow});
+            coalesced++;
+            return Outcome::Queued;
+        }
+        
+        // Become the leader for this key. Enqueueing under inflight_mutex
+        // keeps followers from attaching to a task that ends up rejected.
+        std::function<void()> done = std::move(task.on_complete);
+        task.on_complete = [this, key, response = task.response, cancellation = task.cancellation, done] {
+            finish_leader(key, *response, !response->success() && cancellation && cancellation->expired());
+            done();
+        };
+        std::function<void(const std::string& lines)> partial = std::move(task.on_partial);
+        if (partial) {
+            task.on_partial = [this, key, partial](const std::string& lines) {
+                partial(lines);
+                forward_partial(key, lines);
+            };
+        }
+        
+        if (!pool.try_enqueue(task)) {
+            task.on_complete = std::move(done);
+            task.on_partial = std::move(partial);
+            return Outcome::Rejected;
+        }
+        inflight.emplace(key, Inflight());
+        return Outcome::Queued;
+    }
+    
+    static ContentKey document_key(const ImageRequest& request) {
+        return content_key(request.image_data());
+    }
+    
+    // Fair-queuing flow of a request, see flow_key()
+    std::string flow_of(const ImageRequest& request, const std::string& peer) const {
+        return flow_key(fair_by, request.batch_id(), peer);
+    }
+    
+    int retry_after_ms() { return pool.retry_after_ms(); }
+    QueueStats queue_stats() { return pool.stats(); }
+    CacheStats cache_stats() { return cache.stats(); }
+    std::array<LatencyHistogram::Snapshot, stage_count> stage_latency() { return pool.stage_latency(); }
+    std::array<LatencyHistogram::Snapshot, tier_count> tier_latency() { return pool.tier_latency(); }
+    std::array<StageUtilization, 2> utilization() { return pool.utilization(); }
+    size_t handoff_depth() { return pool.handoff_depth(); }
+    
+    uint64_t coalesced_count() {
+        std::lock_guard<std::mutex> lock(inflight_mutex);
+        return coalesced;
     }
 };
 
-void RunServer(const std::string& server_address, size_t num_threads) {
-    OCRServiceImpl service(num_threads);
+// Response side shared by both RPCs. Each image is split into its pages
+// and every page is submitted as its own task; responses are written one
+// at a time as pages finish, in completion order, and the call finishes
+// once no more input is coming and nothing is pending.
+template <typename Reactor>
+class ResponseStream : public Reactor {
+private:
+    std::mutex mtx;
+    std::deque<std::unique_ptr<OCRResponse>> ready;  // Finished, waiting for the stream
+    std::unique_ptr<OCRResponse> in_flight;          // Currently being written
+    size_t pending;                                  // Submitted, not yet finished
+    bool input_done;
+    bool input_paused;  // A read is held back until the buffered responses drain
+    bool write_failed;
+    bool finished;
+    std::shared_ptr<Cancellation> cancellation;      // Handed to every task of the call
+    std::string peer;
+    
+    void complete(std::unique_ptr<OCRResponse> response) {
+        std::unique_lock<std::mutex> lock(mtx);
+        pending--;
+        if (!write_failed) ready.push_back(std::move(response));
+        pump(lock);
+    }
+    
+    // Queues a partial response for a page that is still pending
+    void progress(std::unique_ptr<OCRResponse> response) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (write_failed) return;
+        ready.push_back(std::move(response));
+        pump(lock);
+    }
+    
+    // Starts the next write or finishes the call. The decision is made under
+    // the caller's lock on mtx, which is released before calling gRPC. Once
+    // the lock is dropped another thread may finish the call and OnDone
+    // delete the reactor, so only a caller that claimed the write or the
+    // finish here touches this afterwards.
+    // A paused read is resumed the same way; while it is paused no read is
+    // outstanding, so the call cannot finish before resume_input() runs.
+    void pump(std::unique_lock<std::mutex>& lock) {
+        const OCRResponse* to_write = nullptr;
+        bool finish = false;
+        bool failed = false;
+        if (!in_flight && !ready.empty()) {
+            in_flight = std::move(ready.front());
+            ready.pop_front();
+            to_write = in_flight.get();
+        } else if (!in_flight && input_done && pending == 0 && !finished) {
+            finished = true;
+            finish = true;
+            failed = write_failed;
+        }
+        bool resume = input_paused && ready.size() + pending < max_buffered;
+        if (resume) input_paused = false;
+        lock.unlock();
+        
+        if (resume) resume_input();
+        if (to_write) {
+            this->StartWrite(to_write);
+        } else if (finish) {
+            this->Finish(failed ? Status(grpc::StatusCode::CANCELLED, "Client stopped reading results")
+                                : Status::OK);
+        }
+    }
+    
+protected:
+    // Responses buffered, finished or not, beyond which a batch stops reading
+    static constexpr size_t max_buffered = 16;
+    
+    OCRDispatcher& dispatcher;
+    
+    ResponseStream(OCRDispatcher& dispatcher, CallbackServerContext* context)
+        : pending(0), input_done(false), input_paused(false), write_failed(false), finished(false),
+          cancellation(std::make_shared<Cancellation>()), peer(context->peer()), dispatcher(dispatcher) {
+        // gRPC reports "no deadline" as the largest time point
+        auto deadline = context->deadline();
+        if (deadline != std::chrono::system_clock::time_point::max()) {
+            cancellation->deadline = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    deadline - std::chrono::system_clock::now());
+        }
+    }
+    
+    // Submits every page of request. A page turned away by admission
+    // control is answered with an overload error, except that with
+    // reject_call a rejected first page queues nothing and returns false.
+    bool submit(std::shared_ptr<const ImageRequest> request, bool reject_call) {
+        const std::string& data = request->image_data();
+        const int pages = ocr_core::page_count(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+        const ContentKey document = OCRDispatcher::document_key(*request);
+        const std::string flow = dispatcher.flow_of(*request, peer);
+        
+        for (int page = 0; page < pages; ++page) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                pending++;
+            }
+            
+            OCRResponse* response = new OCRResponse();
+            OCRTask task{request, page, pages, response, [this, response] {
+                complete(std::unique_ptr<OCRResponse>(response));
+            }, {}, cancellation, flow, {}};
+            if (request->stream_partial()) {
+                task.on_partial = [this, request, page, pages](const std::string& lines) {
+                    auto partial = std::make_unique<OCRResponse>();
+                    partial->set_image_id(request->image_id());
+                    partial->set_filename(request->filename());
+                    partial->set_page(page);
+                    partial->set_page_count(pages);
+                    partial->set_extracted_text(lines);
+                    partial->set_success(true);
+                    partial->set_partial(true);
+                    progress(std::move(partial));
+                };
+            }
+            
+            OCRDispatcher::Outcome outcome = dispatcher.submit(task, document);
+            if (outcome == OCRDispatcher::Outcome::Cached) {
+                complete(std::unique_ptr<OCRResponse>(response));
+            } else if (outcome == OCRDispatcher::Outcome::Rejected) {
+                if (page == 0 && reject_call) {
+                    delete response;
+                    std::lock_guard<std::mutex> lock(mtx);
+                    pending--;
+                    return false;
+                }
+                // Reject just this page; the rest of the call stays open
+                int retry_after = dispatcher.retry_after_ms();
+                response->set_image_id(request->image_id());
+                response->set_filename(request->filename());
+                response->set_page(page);
+                response->set_page_count(pages);
+                response->set_success(false);
+                response->set_error_message(overload_message(retry_after));
+                response->set_retry_after_ms(retry_after);
+                complete(std::unique_ptr<OCRResponse>(response));
+            }
+        }
+        return true;
+    }
+    
+    // Holds back the next read while max_buffered responses are waiting for
+    // a slow client; pump() calls resume_input() once they drain. Returns
+    // true if the read was held back.
+    bool pause_input() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (ready.size() + pending < max_buffered) return false;
+        input_paused = true;
+        return true;
+    }
+    
+    virtual void resume_input() {}
+    
+    // No more images will be submitted
+    void close_input() {
+        std::unique_lock<std::mutex> lock(mtx);
+        input_done = true;
+        pump(lock);
+    }
+    
+public:
+    // The client cancelled or disconnected: queued pages are dropped and
+    // running ones stop at Tesseract's next progress check
+    void OnCancel() override {
+        cancellation->cancelled = true;
+    }
+    
+    void OnWriteDone(bool ok) override {
+        std::unique_lock<std::mutex> lock(mtx);
+        in_flight.reset();
+        if (!ok) {
+            write_failed = true;
+            ready.clear();
+        }
+        pump(lock);
+    }
+};
+
+// Reactor for one ProcessImage call. The request's pages are handed to the
+// pool and the workers that finish them start the writes, so no gRPC
+// thread blocks. A multi-page TIFF streams one response per page.
+class ProcessImageReactor : public ResponseStream<grpc::ServerWriteReactor<OCRResponse>> {
+private:
+    std::string filename;
+    
+public:
+    ProcessImageReactor(OCRDispatcher& dispatcher, CallbackServerContext* context, 
+                        const ImageRequest* request)
+        : ResponseStream(dispatcher, context), filename(request->filename()) {
+        // gRPC keeps request alive until OnDone, which cannot come before
+        // every page has completed, so the tasks borrow it instead of
+        // copying the upload
+        if (!submit(std::shared_ptr<const ImageRequest>(request, [](const ImageRequest*) {}), true)) {
+            // Fail fast and tell the client when to come back
+            int retry_after = dispatcher.retry_after_ms();
+            context->AddTrailingMetadata("retry-after-ms", std::to_string(retry_after));
+            Finish(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, overload_message(retry_after)));
+            return;
+        }
+        close_input();
+    }
+    
+    void OnDone() override {
+        logger().request(LogLevel::Debug, "response_sent", {{"file", filename}});
+        delete this;
+    }
+};
+
+// Reactor for one ProcessBatch stream. Every image read from the client is
+// enqueued immediately and its responses are written as soon as workers
+// finish them, so results may come back out of upload order. Reading stops
+// while a client that is slow to take its results has max_buffered pending.
+class ProcessBatchReactor : public ResponseStream<grpc::ServerBidiReactor<ImageRequest, OCRResponse>> {
+private:
+    ImageRequest request;
+    size_t images;
+    
+public:
+    ProcessBatchReactor(OCRDispatcher& dispatcher, CallbackServerContext* context)
+        : ResponseStream(dispatcher, context), images(0) {
+        StartRead(&request);
+    }
+    
+    void OnReadDone(bool ok) override {
+        if (!ok) {
+            close_input();
+            return;
+        }
+        
+        images++;
+        submit(std::make_shared<ImageRequest>(std::move(request)), false);
+        if (!pause_input()) StartRead(&request);
+    }
+    
+    void resume_input() override {
+        StartRead(&request);
+    }
+    
+    void OnDone() override {
+        logger().log(LogLevel::Info, "batch_closed", {{"images", images}});
+        delete this;
+    }
+};
+
+class OCRServiceImpl final : public OCRService::CallbackService {
+private:
+    OCRDispatcher dispatcher;
+    
+public:
+    OCRServiceImpl(const ServerConfig& config) : dispatcher(config) {}
+    
+    void report() {
+        QueueStats q = dispatcher.queue_stats();
+        logger().log(LogLevel::Info, "queue_stats", {
+            {"depth", q.depth}, {"flows", q.flows}, {"bytes", q.bytes}, {"peak", q.peak_depth},
+            {"accepted", q.accepted}, {"rejected", q.rejected}, {"abandoned", q.abandoned},
+            {"wait_avg_ms", q.avg_wait_ms}, {"wait_max_ms", q.max_wait_ms}});
+        
+        CacheStats c = dispatcher.cache_stats();
+        uint64_t lookups = c.hits + c.misses;
+        logger().log(LogLevel::Info, "cache_stats", {
+            {"entries", c.entries}, {"bytes", c.bytes}, {"hits", c.hits}, {"misses", c.misses},
+            {"hit_rate", lookups ? double(c.hits) / lookups : 0.0}, {"evictions", c.evictions},
+            {"coalesced", dispatcher.coalesced_count()}});
+        
+        size_t handoff = dispatcher.handoff_depth();
+        for (const StageUtilization& u : dispatcher.utilization()) {
+            logger().log(LogLevel::Info, "pipeline_stats", {
+                {"stage", u.stage}, {"threads", u.threads}, {"busy", u.busy}, {"blocked", u.blocked},
+                {"handoff_depth", handoff}});
+        }
+        
+        auto latency = dispatcher.stage_latency();
+        for (size_t i = 0; i < stage_count; ++i) {
+            const LatencyHistogram::Snapshot& h = latency[i];
+            if (h.count == 0) continue;
+            logger().log(LogLevel::Info, "stage_latency", {
+                {"stage", stage_names[i]}, {"count", h.count}, {"mean_ms", h.mean_ms},
+                {"p50_ms", h.p50_ms}, {"p90_ms", h.p90_ms}, {"p99_ms", h.p99_ms},
+                {"p999_ms", h.p999_ms}, {"max_ms", h.max_ms}});
+        }
+        
+        auto tiers = dispatcher.tier_latency();
+        for (size_t i = 0; i < tier_count; ++i) {
+            const LatencyHistogram::Snapshot& h = tiers[i];
+            if (h.count == 0 && q.tier_depth[i] == 0) continue;
+            logger().log(LogLevel::Info, "tier_latency", {
+                {"tier", tier_names[i]}, {"depth", q.tier_depth[i]}, {"count", h.count},
+                {"mean_ms", h.mean_ms}, {"p50_ms", h.p50_ms}, {"p90_ms", h.p90_ms},
+                {"p99_ms", h.p99_ms}, {"max_ms", h.max_ms}});
+        }
+    }
+    
+    grpc::ServerWriteReactor<OCRResponse>* ProcessImage(CallbackServerContext* context,
+                                                        const ImageRequest* request) override {
+        logger().request(LogLevel::Info, "image_received", {
+            {"file", request->filename()}, {"batch", request->batch_id()}, {"id", request->image_id()}});
+        
+        return new ProcessImageReactor(dispatcher, context, request);
+    }
+    
+    grpc::ServerBidiReactor<ImageRequest, OCRResponse>* ProcessBatch(CallbackServerContext* context) override {
+        logger().log(LogLevel::Info, "batch_opened", {{"peer", context->peer()}});
+        
+        return new ProcessBatchReactor(dispatcher, context);
+    }
+};
+
+void RunServer(const ServerConfig& config) {
+    // Before the workers start: stages only switch to kernels that match Leptonica
+    ocr_core::KernelReport kernels = ocr_core::init_kernels(config.kernels);
+    logger().log(kernels.variant == "off" && config.kernels != "off" ? LogLevel::Warn : LogLevel::Info,
+                 "kernels", {{"requested", config.kernels}, {"variant", kernels.variant},
+                             {"grayscale", kernels.grayscale}, {"unsharp", kernels.unsharp},
+                             {"contrast", kernels.contrast}, {"binarize", kernels.binarize}});
+    ocr_core::set_preprocess(config.preprocess);
+    ocr_core::set_split(config.split);
+    ocr_core::Whitelist whitelist;
+    ocr_core::parse_whitelist(config.whitelist, whitelist);
+    ocr_core::set_whitelist(std::move(whitelist));
+    
+    OCRServiceImpl service(config);
     
     ServerBuilder builder;
-    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.AddListeningPort(config.address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
     
     std::unique_ptr<Server> server(builder.BuildAndStart());
     std::cout << "\n=== OCR Server Running ===" << std::endl;
-    std::cout << "Listening on: " << server_address << std::endl;
-    std::cout << "Worker threads: " << num_threads << std::endl;
+    std::cout << "Listening on: " << config.address << std::endl;
+    std::cout << "Preprocessing threads: " << config.preprocess_threads << std::endl;
+    std::cout << "Recognition threads: " << config.num_threads << std::endl;
+    std::cout << "Handoff: " << config.handoff << ", " << config.handoff_queue << " images" << std::endl;
+    std::cout << "Queue limit: " << config.max_queue_tasks << " images / " 
+              << (config.max_queue_bytes >> 20) << " MB" << std::endl;
+    std::cout << "Result cache: " << (config.cache_bytes >> 20) << " MB" << std::endl;
+    std::cout << "Kernels: " << kernels.variant << std::endl;
+    std::cout << "Preprocessing: " << ocr_core::preprocess_names[size_t(config.preprocess)] << std::endl;
+    std::cout << "Page split: " << ocr_core::split_names[size_t(config.split)] << std::endl;
+    std::cout << "Text whitelist: " << config.whitelist << std::endl;
+    std::cout << "Starvation limit: " << config.starvation_ms << " ms" << std::endl;
+    std::cout << "Fair queuing: " << config.fair_by;
+    for (const auto& [flow, weight] : config.flow_weights) {
+        std::cout << " " << flow << "=" << weight;
+    }
+    std::cout << std::endl;
     std::cout << "Press Ctrl+C to stop...\n" << std::endl;
     
+    std::jthread reporter;
+    if (config.stats_interval_s > 0) {
+        reporter = std::jthread([&service, &config](std::stop_token token) {
+            std::mutex mtx;
+            std::condition_variable_any cv;
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                cv.wait_for(lock, token, std::chrono::seconds(config.stats_interval_s), 
+                            [] { return false; });
+                if (token.stop_requested()) break;
+                service.report();
+            }
+        });
+    }
+    
     server->Wait();
 }
 
+// A bound that must be at least 1. std::stoul takes "-1" and wraps it to a
+// huge number, so parse signed; the caller reports what this throws.
+size_t parse_positive(const std::string& value) {
+    long long number = std::stoll(value);
+    if (number < 1) throw std::out_of_range(value);
+    return static_cast<size_t>(number);
+}
+
+void usage() {
+    std::cerr << "Usage: ocr_server [address] [recognize_threads] [--preprocess-threads=N] [--handoff-queue=N]\n"
+              << "                  [--handoff=locked|ring] [--max-queue=N] [--max-queue-mb=MB] [--cache-mb=MB]\n"
+              << "                  [--log-level=debug|info|warn|error] [--log-rate=N] [--stats-interval=S]\n"
+              << "                  [--kernels=auto|scalar|sse4|avx2|avx512|off] [--preprocess=staged|fused|adaptive]\n"
+              << "                  [--split=page|blocks|lines] [--whitelist=SPEC] [--fair-by=batch|peer|none]\n"
+              << "                  [--weight=FLOW=W] [--starvation-ms=MS]" << std::endl;
+}
+
 int main(int argc, char** argv) {
-    std::string server_address = "0.0.0.0:50051";
-    size_t num_threads = 4;
+    ServerConfig config;
+    std::vector<std::string> positional;
     
-    if (argc > 1) {
-        server_address = argv[1];
-    }
-    if (argc > 2) {
-        num_threads = std::stoi(argv[2]);
+    // Set while parsing, so a malformed number names its argument
+    std::string_view current;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            current = arg;
+            if (!arg.starts_with("--")) {
+                positional.emplace_back(arg);
+                continue;
+            }
+            
+            size_t eq = arg.find('=');
+            std::string key(arg.substr(2, eq == std::string_view::npos ? std::string_view::npos : eq - 2));
+            std::string value(eq == std::string_view::npos ? "" : arg.substr(eq + 1));
+            
+            if (key == "max-queue") {
+                config.max_queue_tasks = parse_positive(value);
+            } else if (key == "preprocess-threads") {
+                config.preprocess_threads = std::stoul(value);
+            } else if (key == "handoff-queue") {
+                config.handoff_queue = std::stoul(value);
+            } else if (key == "handoff") {
+                if (value != "locked" && value != "ring") {
+                    std::cerr << "Unknown handoff: " << value << std::endl;
+                    return 1;
+                }
+                config.handoff = value;
+            } else if (key == "max-queue-mb") {
+                config.max_queue_bytes = parse_positive(value) << 20;
+            } else if (key == "cache-mb") {
+                config.cache_bytes = std::stoull(value) << 20;
+            } else if (key == "log-level") {
+                if (value == "debug") config.log_level = LogLevel::Debug;
+                else if (value == "info") config.log_level = LogLevel::Info;
+                else if (value == "warn") config.log_level = LogLevel::Warn;
+                else if (value == "error") config.log_level = LogLevel::Error;
+                else {
+                    std::cerr << "Unknown log level: " << value << std::endl;
+                    return 1;
+                }
+            } else if (key == "log-rate") {
+                config.log_rate = std::stoll(value);
+            } else if (key == "stats-interval") {
+                config.stats_interval_s = std::stoi(value);
+            } else if (key == "kernels") {
+                if (value != "auto" && value != "scalar" && value != "sse4" && value != "avx2" &&
+                    value != "avx512" && value != "off") {
+                    std::cerr << "Unknown kernels: " << value << std::endl;
+                    return 1;
+                }
+                config.kernels = value;
+            } else if (key == "preprocess") {
+                auto& names = ocr_core::preprocess_names;
+                auto found = std::find(std::begin(names), std::end(names), value);
+                if (found == std::end(names)) {
+                    std::cerr << "Unknown preprocess mode: " << value << std::endl;
+                    return 1;
+                }
+                config.preprocess = ocr_core::Preprocess(found - std::begin(names));
+            } else if (key == "split") {
+                auto& names = ocr_core::split_names;
+                auto found = std::find(std::begin(names), std::end(names), value);
+                if (found == std::end(names)) {
+                    std::cerr << "Unknown split mode: " << value << std::endl;
+                    return 1;
+                }
+                config.split = ocr_core::Split(found - std::begin(names));
+            } else if (key == "whitelist") {
+                ocr_core::Whitelist whitelist;
+                if (!ocr_core::parse_whitelist(value, whitelist)) {
+                    std::cerr << "Bad whitelist: " << value << std::endl;
+                    return 1;
+                }
+                config.whitelist = value;
+            } else if (key == "fair-by") {
+                if (value != "batch" && value != "peer" && value != "none") {
+                    std::cerr << "Unknown fair-by: " << value << std::endl;
+                    return 1;
+                }
+                config.fair_by = value;
+            } else if (key == "starvation-ms") {
+                config.starvation_ms = std::stoi(value);
+            } else if (key == "weight") {
+                // --weight=FLOW=W, FLOW being a peer host such as ipv4:10.0.0.5 or
+                // a batch of one such as ipv4:10.0.0.5/7
+                size_t split = value.rfind('=');
+                if (split == 0 || split == std::string::npos ||
+                    std::stod(value.substr(split + 1)) < FairQueue<OCRTask>::min_weight) {
+                    std::cerr << "Bad weight: " << value << std::endl;
+                    return 1;
+                }
+                config.flow_weights[value.substr(0, split)] = std::stod(value.substr(split + 1));
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                usage();
+                return 1;
+            }
+        }
+        
+        if (positional.size() > 0) {
+            config.address = positional[0];
+        }
+        if (positional.size() > 1) {
+            current = positional[1];
+            config.num_threads = std::stoi(positional[1]);
+        }
+    } catch (const std::logic_error&) {
+        // std::stoi and friends on a malformed or out-of-range number, or a
+        // bound below 1
+        std::cerr << "Bad number in " << current << std::endl;
+        usage();
+        return 1;
     }
     
-    RunServer(server_address, num_threads);
+    logger().set_level(config.log_level);
+    logger().set_request_rate(config.log_rate);
+    
+    RunServer(config);
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Handoff between worker threads.
+//
+// WorkQueue is a bounded queue that never blocks, implemented by
+// MPMCQueue, a lock-free ring open to any number of producers and
+// consumers, and by LockedQueue, a deque under a mutex. EventCount lets a
+// consumer that found every queue empty go to sleep on a futex, and costs
+// producers a wakeup only when somebody is actually asleep. take_or_park()
+// combines the two into the idle loop of a worker: optionally spin, then
+// park.
+
+template <typename T>
+class WorkQueue {
+public:
+    virtual ~WorkQueue() = default;
+    
+    // Moves value in unless the queue is full, in which case it is untouched
+    virtual bool try_push(T&& value) = 0;
+    virtual bool try_pop(T& value) = 0;
+};
+
+// Bounded multi-producer multi-consumer ring (Vyukov-style sequence
+// numbers, as in the logger). T must be default-constructible and movable.
+// A producer preempted between claiming and publishing a slot hides every
+// later item until it runs again, so it only pays off with a core per
+// thread.
+template <typename T>
+class MPMCQueue final : public WorkQueue<T> {
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+    
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;  // Next position to push
+    alignas(64) std::atomic<size_t> tail;  // Next position to pop
+    
+public:
+    explicit MPMCQueue(size_t capacity) : head(0), tail(0) {
+        // One slot cannot tell full from empty: its sequence after a push
+        // equals the next push position
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots = std::make_unique<Slot[]>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+    
+    size_t capacity() const { return mask + 1; }
+    
+    bool try_push(T&& value) override {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    
+    bool try_pop(T& value) override {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(slot->value);
+        slot->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+template <typename T>
+class LockedQueue final : public WorkQueue<T> {
+private:
+    std::mutex mutex;
+    std::deque<T> items;
+    size_t capacity;
+    
+public:
+    explicit LockedQueue(size_t capacity) : capacity(capacity) {}
+    
+    bool try_push(T&& value) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() >= capacity) return false;
+        items.push_back(std::move(value));
+        return true;
+    }
+    
+    bool try_pop(T& value) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) return false;
+        value = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+};
+
+// Sleep/wake for consumers of lock-free queues. A consumer calls
+// prepare_wait(), checks its queues once more and then either
+// cancel_wait()s or wait()s with the key; producers call notify_one() or
+// notify_all() after publishing. The fences guarantee that either the
+// consumer sees the item or the producer sees the waiter.
+class EventCount {
+private:
+    alignas(64) std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> waiters{0};
+    
+    void notify(bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) return;
+        epoch.fetch_add(1, std::memory_order_relaxed);
+        if (all) epoch.notify_all();
+        else epoch.notify_one();
+    }
+    
+public:
+    uint32_t prepare_wait() {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_relaxed);
+    }
+    
+    void cancel_wait() {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    
+    // Returns once a notify() follows prepare_wait(), possibly at once
+    void wait(uint32_t key) {
+        epoch.wait(key, std::memory_order_relaxed);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    
+    void notify_one() { notify(false); }
+    void notify_all() { notify(true); }
+};
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// How long an idle worker polls before it parks. Spinning lets a burst of
+// small items skip the sleep, but only when nobody else wants the core.
+struct SpinPolicy {
+    int spins = 0;
+    int yields = 0;
+    
+    // Spins while every worker has a core of its own
+    static SpinPolicy for_threads(size_t threads) {
+        if (threads <= std::max(std::thread::hardware_concurrency(), 1u)) return {64, 4};
+        return {0, 1};
+    }
+};
+
+// Idle loop of a worker: polls try_take as policy says, then parks on
+// events. Returns false, with nothing taken, once stopped() is true.
+template <typename TryTake, typename Stopped>
+bool take_or_park(EventCount& events, TryTake&& try_take, Stopped&& stopped, SpinPolicy policy = {}) {
+    if (try_take()) return true;
+    for (int i = 0; i < policy.spins; ++i) {
+        if (try_take()) return true;
+        cpu_relax();
+    }
+    // Give the CPU to a producer that may be mid-push before sleeping
+    for (int i = 0; i < policy.yields; ++i) {
+        if (try_take()) return true;
+        std::this_thread::yield();
+    }
+    while (true) {
+        uint32_t key = events.prepare_wait();
+        if (try_take()) {
+            events.cancel_wait();
+            return true;
+        }
+        if (stopped()) {
+            events.cancel_wait();
+            return false;
+        }
+        events.wait(key);
+    }
+}
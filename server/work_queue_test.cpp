@@ -0,0 +1,115 @@
+#include "work_queue.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Bounds and multi-threaded delivery of the worker pool's handoff queues.
+
+namespace {
+
+template <typename Queue>
+class WorkQueueTest : public testing::Test {};
+
+using Queues = testing::Types<MPMCQueue<uint32_t>, LockedQueue<uint32_t>>;
+TYPED_TEST_SUITE(WorkQueueTest, Queues);
+
+TYPED_TEST(WorkQueueTest, IsFifoAndBounded) {
+    TypeParam queue(4);
+    uint32_t item = 0;
+    EXPECT_FALSE(queue.try_pop(item));
+    
+    // Twice around the ring
+    for (uint32_t round = 0; round < 2; ++round) {
+        for (uint32_t i = 0; i < 4; ++i) {
+            uint32_t value = round * 4 + i;
+            ASSERT_TRUE(queue.try_push(std::move(value)));
+        }
+        uint32_t extra = 99;
+        EXPECT_FALSE(queue.try_push(std::move(extra)));
+        for (uint32_t i = 0; i < 4; ++i) {
+            ASSERT_TRUE(queue.try_pop(item));
+            EXPECT_EQ(item, round * 4 + i);
+        }
+        EXPECT_FALSE(queue.try_pop(item));
+    }
+}
+
+TEST(MPMCQueue, RoundsCapacityUpToAPowerOfTwo) {
+    EXPECT_EQ(MPMCQueue<int>(1).capacity(), 2u);
+    EXPECT_EQ(MPMCQueue<int>(5).capacity(), 8u);
+    EXPECT_EQ(MPMCQueue<int>(64).capacity(), 64u);
+}
+
+TEST(MPMCQueue, LeavesAValueThatDidNotFit) {
+    MPMCQueue<std::unique_ptr<int>> queue(2);
+    ASSERT_TRUE(queue.try_push(std::make_unique<int>(1)));
+    ASSERT_TRUE(queue.try_push(std::make_unique<int>(1)));
+    auto value = std::make_unique<int>(2);
+    EXPECT_FALSE(queue.try_push(std::move(value)));
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, 2);
+}
+
+TEST(TakeOrPark, ReturnsFalseOnceStopped) {
+    EventCount events;
+    std::atomic<bool> stopped{false};
+    std::thread waiter([&] {
+        EXPECT_FALSE(take_or_park(events, [] { return false; }, [&] { return stopped.load(); }));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stopped = true;
+    events.notify_all();
+    waiter.join();
+}
+
+// Producers and consumers hammer a small queue the way the pool's workers
+// do; every item must come out exactly once
+TYPED_TEST(WorkQueueTest, DeliversEveryItemOnce) {
+    constexpr uint32_t producers = 4, consumers = 4, per_producer = 25000;
+    constexpr uint32_t total = producers * per_producer;
+    TypeParam queue(64);
+    EventCount ready;
+    SpinPolicy policy = SpinPolicy::for_threads(producers + consumers);
+    std::vector<std::atomic<uint32_t>> seen(total);
+    std::atomic<uint32_t> taken{0};
+    std::atomic<bool> done{false};
+    
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for (uint32_t i = 0; i < per_producer; ++i) {
+                uint32_t item = p * per_producer + i;
+                while (!queue.try_push(std::move(item))) std::this_thread::yield();
+                ready.notify_one();
+            }
+        });
+    }
+    for (uint32_t c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            uint32_t item;
+            while (take_or_park(ready, [&] { return queue.try_pop(item); }, [&] { return done.load(); }, policy)) {
+                seen[item].fetch_add(1, std::memory_order_relaxed);
+                if (taken.fetch_add(1) + 1 == total) {
+                    done = true;
+                    ready.notify_all();
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    
+    EXPECT_EQ(taken.load(), total);
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < total; ++i) {
+        if (seen[i].load() != 1) wrong++;
+    }
+    EXPECT_EQ(wrong, 0u);
+    uint32_t item;
+    EXPECT_FALSE(queue.try_pop(item));
+}
+
+}  // namespace